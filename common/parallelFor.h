@@ -0,0 +1,190 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Split [begin, end) in chunks of grain_size and run them across worker threads.
+func is called as func(chunk_begin, chunk_end) and must be reentrant.
+The workers belong to one pool per plugin, started on the first call and kept
+until parallel_for_shutdown, so a call only pays for waking them. The calling
+thread takes part in the work, small ranges and calls made from inside a
+chunk run inline. Calls from several threads at once share the workers.
+Independent from the Maya API so the standalone benches and tests run it too.
+*/
+
+class ThreadPool
+{
+public:
+    static ThreadPool& instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ~ThreadPool() { shutdown(); }
+
+    // call chunk(i) for every i in [0, num_chunks), returns once all of them ran
+    void run(int num_chunks, const std::function<void(int)>& chunk)
+    {
+        if (num_chunks <= 0) return;
+        if (num_chunks == 1 || insideChunk() || !start())
+        {
+            for (int i = 0; i < num_chunks; ++i)
+            {
+                chunk(i);
+            }
+            return;
+        }
+
+        Job job(chunk, num_chunks);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(&job);
+        }
+        _wake.notify_all();
+
+        // the caller works through its own job, it may be the only thread free
+        for (int i = job.next++; i < num_chunks; i = job.next++)
+        {
+            runChunk(job, i);
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto queued = std::find(_jobs.begin(), _jobs.end(), &job);
+        if (queued != _jobs.end()) _jobs.erase(queued);
+        _finished.wait(lock, [&job]() { return job.remaining == 0; });
+    }
+
+    // join the workers, before the plugin unloads so it never happens in static
+    // destruction. a later run starts them again
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_all();
+        for (auto& thread : _threads)
+        {
+            thread.join();
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _threads.clear();
+        _stopping = false;
+    }
+
+private:
+    struct Job
+    {
+        Job(const std::function<void(int)>& chunk, int num_chunks) :
+            chunk(chunk), num_chunks(num_chunks), next(0), remaining(num_chunks) {}
+
+        const std::function<void(int)>& chunk;
+        const int num_chunks;
+        std::atomic<int> next;       // next chunk to hand out
+        std::atomic<int> remaining;  // chunks not finished yet
+    };
+
+    ThreadPool() {}
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // true on a worker thread and on a caller while it runs a chunk
+    static bool& insideChunk()
+    {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    // workers for every core but the caller's, false when there are none
+    bool start()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_threads.empty())
+        {
+            const unsigned num_workers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+            for (unsigned i = 0; i < num_workers; ++i)
+            {
+                _threads.emplace_back(&ThreadPool::work, this);
+            }
+        }
+        return !_threads.empty();
+    }
+
+    void runChunk(Job& job, int i)
+    {
+        insideChunk() = true;
+        job.chunk(i);
+        insideChunk() = false;
+
+        // the caller may return as soon as remaining reaches 0, job is not touched after it
+        if (--job.remaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _finished.notify_all();
+        }
+    }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _wake.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+            if (_stopping) return;
+
+            // the job stays queued, and alive, until its last chunk is handed out
+            Job* job = _jobs.front();
+            const int i = job->next++;
+            if (i + 1 >= job->num_chunks) _jobs.pop_front();
+            if (i >= job->num_chunks) continue;
+
+            lock.unlock();
+            runChunk(*job, i);
+            lock.lock();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _finished;
+    std::deque<Job*> _jobs;
+    std::vector<std::thread> _threads;
+    bool _stopping = false;
+};
+
+template <typename Function>
+void parallel_for(int begin, int end, int grain_size, const Function& func)
+{
+    if (end <= begin) return;
+
+    grain_size = std::max(1, grain_size);
+    const int num_chunks = (end - begin + grain_size - 1) / grain_size;
+    if (num_chunks <= 1)
+    {
+        func(begin, end);
+        return;
+    }
+
+    ThreadPool::instance().run(num_chunks, [&](int chunk) {
+        const int chunk_begin = begin + chunk * grain_size;
+        func(chunk_begin, std::min(end, chunk_begin + grain_size));
+    });
+}
+
+// join the pool workers, called when the plugin unloads
+inline void parallel_for_shutdown()
+{
+    ThreadPool::instance().shutdown();
+}
+
+#endif // !PARALLEL_FOR_H
@@ -0,0 +1,315 @@
+// Times the shell grid evaluation outside of Maya, the per-point Eval against the
+// ShellGrid factor tables, serial and across threads, and reports how far apart
+// the results are. Also checks the fast sin, cos and exp against double
+// precision and the AVX2 paths against the scalar ones, exits 1 on a failure.
+//
+//   g++ -O2 -std=c++11 -pthread shell_bench.cpp shell_eval.cpp -o shell_bench
+//   ./shell_bench [columns] [rows]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "../common/parallelFor.h"
+#include "shell_eval.h"
+
+#define Rad(x) ((x)*3.14159265358979323846f/180.0f)
+
+// the node defaults, with the nodules of the second and third set switched on
+static ShellParams default_params(int ni, int nj)
+{
+    ShellParams sp;
+    sp.alpha = Rad(80.f);
+    sp.beta = Rad(90.f);
+    sp.phi = Rad(1.f);
+    sp.my = Rad(1.f);
+    sp.omega = Rad(1.f);
+    sp.omin = Rad(0.f);
+    sp.omax = Rad(1200.f);
+    sp.od = (sp.omax - sp.omin) / nj;
+    sp.smin = Rad(-190.f);
+    sp.smax = Rad(190.f);
+    sp.sd = (sp.smax - sp.smin) / ni;
+    sp.A = 1.9f;
+    sp.a = 1.f;
+    sp.b = 0.9f;
+    sp.scale = 0.3f;
+
+    sp.P = Rad(10.f);
+    sp.L = 1.f;
+    sp.N = 15.f;
+    sp.W1 = Rad(100.f);
+    sp.W2 = Rad(20.f);
+    sp.nstart = Rad(0.f);
+
+    sp.P2 = Rad(60.f);
+    sp.L2 = 0.5f;
+    sp.N2 = 7.f;
+    sp.W12 = Rad(30.f);
+    sp.W22 = Rad(30.f);
+    sp.off2 = Rad(10.f);
+    sp.nstart2 = Rad(600.f);
+
+    sp.P3 = Rad(-60.f);
+    sp.L3 = 0.3f;
+    sp.N3 = 11.f;
+    sp.W13 = Rad(30.f);
+    sp.W23 = Rad(30.f);
+    sp.off3 = Rad(0.f);
+    sp.nstart3 = Rad(0.f);
+
+    sp.uamp = 0.05f;
+    sp.ufreq = 4.f;
+    sp.urib = 0.3f;
+    sp.vamp = 0.f;
+    sp.vfreq = 0.f;
+    sp.vrib = 0.f;
+    return sp;
+}
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the whole grid from the tables, rows across the cores as Rebuild runs them
+static void evaluate(ShellGrid& grid, const ShellParams& sp, int ni, int nj, bool fast,
+    std::vector<float>& points)
+{
+    points.resize(4 * (size_t)ni * nj);
+    grid.Prepare(sp, ni, nj, fast);
+    parallel_for(0, nj, grid.RowGrain(), [&](int begin, int end) {
+        for (int j = begin; j < end; ++j)
+        {
+            grid.EvalRow(j, &points[4 * (size_t)j * ni]);
+        }
+    });
+}
+
+// largest difference between two grids, relative to the extent of the first one
+static float relative_error(const std::vector<float>& reference, const std::vector<float>& points)
+{
+    float extent = 0.f;
+    float max_error = 0.f;
+    for (size_t k = 0; k < reference.size(); ++k)
+    {
+        extent = std::max(extent, std::fabs(reference[k]));
+        max_error = std::max(max_error, std::fabs(reference[k] - points[k]));
+    }
+    return extent > 0.f ? max_error / extent : max_error;
+}
+
+static bool identical(const std::vector<float>& a, const std::vector<float>& b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+// every point through the per-point Eval, the loop the node used to run
+static void evaluate_points(const ShellParams& sp, int ni, int nj, std::vector<float>& points)
+{
+    points.resize(4 * (size_t)ni * nj);
+    float o = sp.omin;
+    for (int j = 0; j < nj; ++j)
+    {
+        float s = sp.smin;
+        float* p = &points[4 * (size_t)j * ni];
+        for (int i = 0; i < ni; ++i, p += 4)
+        {
+            Eval(sp, p, o, s);
+            p[3] = 1.f;
+            s += sp.sd;
+        }
+        o += sp.od;
+    }
+}
+
+static bool all_finite(const std::vector<float>& points)
+{
+    for (size_t k = 0; k < points.size(); ++k)
+    {
+        if (!std::isfinite(points[k])) return false;
+    }
+    return true;
+}
+
+// the tables against Eval for one parameter set, both finite and within float error
+static bool check_against_eval(const char* name, const ShellParams& sp, int ni, int nj)
+{
+    std::vector<float> reference;
+    std::vector<float> points;
+    ShellGrid grid;
+    evaluate_points(sp, ni, nj, reference);
+    evaluate(grid, sp, ni, nj, false, points);
+
+    const bool finite = all_finite(reference) && all_finite(points);
+    const float error = relative_error(reference, points);
+    const bool ok = finite && error <= 1e-6f;
+    printf("%-24s %s, max error %g of the extent\n", name, finite ? "finite" : "NOT FINITE", error);
+    return ok;
+}
+
+// one parameter changed on a prepared grid, only its layer recomputed, against a
+// fresh grid prepared from scratch
+static bool check_layer(const char* name, ShellParams sp, int ni, int nj, float ShellParams::*param,
+    float value, unsigned layer)
+{
+    ShellGrid grid;
+    std::vector<float> points;
+    evaluate(grid, sp, ni, nj, false, points);
+
+    sp.*param = value;
+    auto start = std::chrono::steady_clock::now();
+    grid.Prepare(sp, ni, nj, false, layer);
+    const double prepare_ms = milliseconds_since(start);
+    parallel_for(0, nj, grid.RowGrain(), [&](int begin, int end) {
+        for (int j = begin; j < end; ++j)
+        {
+            grid.EvalRow(j, &points[4 * (size_t)j * ni]);
+        }
+    });
+    const double layer_ms = milliseconds_since(start);
+
+    std::vector<float> reference(points.size(), 0.f);
+    ShellGrid fresh;
+    start = std::chrono::steady_clock::now();
+    evaluate(fresh, sp, ni, nj, false, reference);
+    const double full_ms = milliseconds_since(start);
+
+    const bool same = identical(reference, points);
+    printf("%-8s layer %7.2f ms (prepare %.3f ms), full %7.2f ms, %s\n", name, layer_ms, prepare_ms,
+        full_ms, same ? "identical" : "DIFFERS");
+    return same;
+}
+
+// fast sin, cos and exp against double precision libm on a dense sampling
+static bool check_approximations()
+{
+    const int n = 1 << 20;
+    std::vector<float> x(n), s(n), c(n);
+
+    float sincos_error = 0.f;
+    for (int i = 0; i < n; ++i)
+    {
+        x[i] = -100.f + 200.f * i / (n - 1);
+    }
+    ShellSinCos(x.data(), s.data(), c.data(), n, true);
+    for (int i = 0; i < n; ++i)
+    {
+        sincos_error = std::max(sincos_error, (float)std::fabs(s[i] - std::sin((double)x[i])));
+        sincos_error = std::max(sincos_error, (float)std::fabs(c[i] - std::cos((double)x[i])));
+    }
+
+    float exp_error = 0.f;
+    for (int i = 0; i < n; ++i)
+    {
+        x[i] = -87.f + 175.f * i / (n - 1);
+    }
+    ShellExp(x.data(), s.data(), n, true);
+    for (int i = 0; i < n; ++i)
+    {
+        const double e = std::exp((double)x[i]);
+        exp_error = std::max(exp_error, (float)(std::fabs(s[i] - e) / e));
+    }
+
+    // the bounds documented in shell_eval.h
+    const bool ok = sincos_error <= 1.5e-7f && exp_error <= 1.5e-7f;
+    printf("fast sin cos  max error %g on [-100, 100]\n", sincos_error);
+    printf("fast exp      max relative error %g on [-87, 88]\n", exp_error);
+    return ok;
+}
+
+
+int main(int argc, char** argv)
+{
+    const int ni = argc > 1 ? atoi(argv[1]) : 2000;
+    const int nj = argc > 2 ? atoi(argv[2]) : 2000;
+    if (ni < 1 || nj < 1) return 1;
+
+    const ShellParams sp = default_params(ni, nj);
+    std::vector<float> direct(4 * (size_t)ni * nj);
+    std::vector<float> tables(direct.size());
+
+    // per point, the loop the node used to run
+    auto start = std::chrono::steady_clock::now();
+    evaluate_points(sp, ni, nj, direct);
+    const double direct_ms = milliseconds_since(start);
+
+    // factor tables, prepared once then combined per point
+    start = std::chrono::steady_clock::now();
+    ShellGrid grid;
+    grid.Prepare(sp, ni, nj);
+    const double prepare_ms = milliseconds_since(start);
+    for (int j = 0; j < nj; ++j)
+    {
+        grid.EvalRow(j, &tables[4 * (size_t)j * ni]);
+    }
+    const double tables_ms = milliseconds_since(start);
+
+    // outputs touched once before timing, like the node's buffers
+    std::vector<float> threaded(tables.size(), 0.f);
+    std::vector<float> fast(tables.size(), 0.f);
+    start = std::chrono::steady_clock::now();
+    evaluate(grid, sp, ni, nj, false, threaded);
+    const double threaded_ms = milliseconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    evaluate(grid, sp, ni, nj, true, fast);
+    const double fast_ms = milliseconds_since(start);
+
+    // scalar code for both modes, the vector paths must not move a bit
+    const bool avx2 = ShellAVX2Enabled();
+    std::vector<float> scalar;
+    std::vector<float> scalar_fast;
+    ShellEnableAVX2(false);
+    evaluate(grid, sp, ni, nj, false, scalar);
+    evaluate(grid, sp, ni, nj, true, scalar_fast);
+    ShellEnableAVX2(true);
+
+    bool ok = identical(tables, threaded);
+    printf("grid %d x %d, avx2 %s\n", ni, nj, avx2 ? "on" : "off");
+    printf("per point  %9.2f ms\n", direct_ms);
+    printf("tables     %9.2f ms (prepare %.2f ms), %.1fx\n", tables_ms, prepare_ms, direct_ms / tables_ms);
+    printf("threaded   %9.2f ms, %u threads, %d rows per task, %s\n", threaded_ms,
+        std::max(1u, std::thread::hardware_concurrency()), grid.RowGrain(),
+        ok ? "identical to serial" : "DIFFERS from serial");
+    printf("fast math  %9.2f ms\n", fast_ms);
+    if (avx2)
+    {
+        const bool same = identical(tables, scalar) && identical(fast, scalar_fast);
+        printf("avx2       %s\n", same ? "identical to scalar" : "DIFFERS from scalar");
+        ok = ok && same;
+    }
+    printf("tables against per point, max error %g of the extent\n", relative_error(direct, tables));
+    printf("fast math against per point, max error %g of the extent\n", relative_error(direct, fast));
+
+    // a column right on a nodule of zero width, 0 / 0 unless the nodule counts as off
+    ShellParams degenerate = default_params(4, 30);
+    degenerate.smin = Rad(-20.f);
+    degenerate.smax = Rad(20.f);
+    degenerate.sd = Rad(10.f);
+    degenerate.P3 = 0.f;
+    degenerate.W13 = 0.f;
+    degenerate.L3 = 0.f;
+    ok = check_against_eval("zero width, nodule off", degenerate, 4, 30) && ok;
+    degenerate.L3 = 0.3f;
+    ok = check_against_eval("zero width, nodule on", degenerate, 4, 30) && ok;
+    degenerate = default_params(4, 30);
+    degenerate.smin = Rad(-20.f);
+    degenerate.smax = Rad(20.f);
+    degenerate.sd = Rad(10.f);
+    degenerate.P = 0.f;
+    degenerate.nstart = Rad(600.f);
+    ok = check_against_eval("before nodule start", degenerate, 4, 30) && ok;
+
+    ok = check_layer("ellipse", sp, ni, nj, &ShellParams::a, 1.2f, kShellSection) && ok;
+    ok = check_layer("ribs", sp, ni, nj, &ShellParams::uamp, 0.1f, kShellRibs) && ok;
+    ok = check_layer("nodules", sp, ni, nj, &ShellParams::L, 0.7f, kShellNodules) && ok;
+    ok = check_layer("frame", sp, ni, nj, &ShellParams::omega, Rad(5.f), kShellFrame) && ok;
+    ok = check_approximations() && ok;
+    return ok ? 0 : 1;
+}
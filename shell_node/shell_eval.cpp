@@ -0,0 +1,645 @@
+#include "shell_eval.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHELL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHELL_AVX2_TARGET
+#else
+#define SHELL_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+#define FPI 3.14159265358979323846264338327950288419716939937510582f
+
+// l2 budget per core for one task, the smallest l2 on the workstations we target
+#define SHELL_L2_BYTES (256 * 1024)
+
+// sin and cos, quadrant of x then minimax polynomials on [-pi/4, pi/4] (cephes)
+#define SHELL_2_OVER_PI 0.636619772367581343f
+#define SHELL_PI_2_HI 1.5703125f
+#define SHELL_PI_2_MID 4.837512969970703125e-4f
+#define SHELL_PI_2_LO 7.54978995489188216e-8f
+#define SHELL_SIN_1 -1.9515295891e-4f
+#define SHELL_SIN_2 8.3321608736e-3f
+#define SHELL_SIN_3 -1.6666654611e-1f
+#define SHELL_COS_1 2.443315711809948e-5f
+#define SHELL_COS_2 -1.388731625493765e-3f
+#define SHELL_COS_3 4.166664568298827e-2f
+
+// exp, power of two of x then a polynomial on [-ln2/2, ln2/2] (cephes)
+#define SHELL_EXP_MIN -87.f
+#define SHELL_EXP_MAX 88.f
+#define SHELL_LOG2E 1.44269504088896341f
+#define SHELL_LN2_HI 0.693359375f
+#define SHELL_LN2_LO -2.12194440e-4f
+#define SHELL_EXP_1 1.9875691500e-4f
+#define SHELL_EXP_2 1.3981999507e-3f
+#define SHELL_EXP_3 8.3334519073e-3f
+#define SHELL_EXP_4 4.1665795894e-2f
+#define SHELL_EXP_5 1.6666665459e-1f
+#define SHELL_EXP_6 5.0000001201e-1f
+
+static bool cpu_has_avx2();
+static float rib(float amp, float percent, float c);
+static void fast_sincos(float x, float& s, float& c);
+static float fast_exp(float x);
+#ifdef SHELL_X86
+static int sincos_avx2(const float *x, float *s, float *c, int n);
+static int exp_avx2(const float *x, float *e, int n);
+#endif
+
+static bool avx2_enabled = cpu_has_avx2();
+
+inline float SafeCot(float x)
+{
+    float s = sinf(x);
+    return s ? cosf(x) / s : 0.0f;
+}
+
+inline float G(float a, float n)
+{
+    if (!n) return n;
+    float z = 2.0f * FPI;
+    a *= n / z;
+    return z / n*(a - floorf(0.5f + a));
+}
+
+float Ribs(const ShellParams& sp, float u, float v)
+{
+    float zu = 0.f;
+    if (sp.uamp) zu = rib(sp.uamp, sp.urib, cosf(2.f * FPI * sp.ufreq * u));
+    float zv = 0.f;
+    if (sp.vamp) zv = rib(sp.vamp, sp.vrib, cosf(2.f * FPI * sp.vfreq * v));
+
+    return zu + zv;
+}
+
+float Nodules(const ShellParams& sp, float s, float o)
+{
+    float p1;
+    float p2;
+    float k = 0.f;
+    float g = 0.f;
+
+    // a nodule of zero width is off, like one of zero amplitude
+    if (sp.L && sp.N && sp.W1 && sp.W2 && o >= sp.nstart)
+    {
+        g = G(o, sp.N);
+        p1 = g / sp.W2;
+        p2 = (s - sp.P) / sp.W1;
+        k = sp.L * expf(-4.f * (p1 * p1 + p2 * p2));
+    }
+
+    if (sp.L2 && sp.N2 && sp.W12 && sp.W22 && o >= sp.nstart2)
+    {
+        g = G(o + sp.off2, sp.N2);
+        p1 = g / sp.W22;
+        p2 = (s - sp.P2) / sp.W12;
+        k = sp.L * expf(-4.f * (p1*p1 + p2*p2));
+    }
+
+    if (sp.L2 && sp.N2 && sp.W12 && sp.W22 && o >= sp.nstart2)
+    {
+        g = G(o + sp.off2, sp.N2);
+        p1 = g / sp.W22;
+        p2 = (s - sp.P2) / sp.W12;
+        k += sp.L2 *expf(-4.f * (p1 * p1 + p2 * p2));
+    }
+
+    if (sp.L3 && sp.N3 && sp.W13 && sp.W23 && o >= sp.nstart3)
+    {
+        g = G(o + sp.off3, sp.N3);
+        p1 = g / sp.W23;
+        p2 = (s - sp.P3) / sp.W13;
+        k += sp.L3 * expf(-4.f * (p1*p1 + p2*p2));
+    }
+    return k;
+}
+
+void Eval(const ShellParams& sp, float *p, float o, float s)
+{
+    float ss = sinf(s);
+    float cs = cosf(s);
+    float re = 1.f / sqrtf(cs * cs / (sp.a*sp.a)
+        + ss*ss / (sp.b * sp.b));
+
+    float sc = sp.scale * expf(o * SafeCot(sp.alpha));
+    float csphi = cosf(s + sp.phi);
+    float ssphi = sinf(s + sp.phi);
+    float sbeta = sinf(sp.beta);
+    float smy = sinf(sp.my);
+    float r = re + Nodules(sp, s, o) + Ribs(sp, s, 0);
+
+    float x = sp.A * sbeta * cosf(o)
+        + r * csphi * cosf(o + sp.omega)
+        - r * smy * ssphi * sinf(o);
+
+    float y = sp.A * sbeta * cosf(o)
+        + r * csphi * sinf(o + sp.omega)
+        - r * smy * ssphi * cosf(o);
+
+    float z = -sp.A * cosf(sp.beta)
+        + r * ssphi * cosf(sp.my);
+
+    p[0] = x * sc;
+    p[1] = -z * sc;
+    p[2] = y * sc;
+}
+
+void ShellSinCos(const float *x, float *s, float *c, int n, bool fast)
+{
+    int i = 0;
+    if (!fast)
+    {
+        for (; i < n; ++i)
+        {
+            s[i] = sinf(x[i]);
+            c[i] = cosf(x[i]);
+        }
+        return;
+    }
+
+#ifdef SHELL_X86
+    if (avx2_enabled) i = sincos_avx2(x, s, c, n);
+#endif
+    for (; i < n; ++i)
+    {
+        fast_sincos(x[i], s[i], c[i]);
+    }
+}
+
+void ShellExp(const float *x, float *e, int n, bool fast)
+{
+    int i = 0;
+    if (!fast)
+    {
+        for (; i < n; ++i)
+        {
+            e[i] = expf(x[i]);
+        }
+        return;
+    }
+
+#ifdef SHELL_X86
+    if (avx2_enabled) i = exp_avx2(x, e, n);
+#endif
+    for (; i < n; ++i)
+    {
+        e[i] = fast_exp(x[i]);
+    }
+}
+
+bool ShellAVX2Enabled()
+{
+    return avx2_enabled;
+}
+
+void ShellEnableAVX2(bool enable)
+{
+    avx2_enabled = enable && cpu_has_avx2();
+}
+
+void ShellGrid::Prepare(const ShellParams& sp, int ni, int nj, bool fast, unsigned dirty)
+{
+    ni = std::max(0, ni);
+    nj = std::max(0, nj);
+    if (ni != Columns() || nj != Rows() || fast != fastMath || !prepared) dirty = kShellAll;
+    fastMath = fast;
+    prepared = true;
+
+    if (dirty == kShellAll)
+    {
+        columns.angle.resize(ni);
+        columns.ellipse.resize(ni);
+        columns.ribs.resize(ni);
+        columns.radius.resize(ni);
+        columns.csphi.resize(ni);
+        columns.slant.resize(ni);
+        columns.height.resize(ni);
+        for (int k = 0; k < 3; ++k)
+        {
+            columns.nodule[k].resize(ni);
+        }
+        rows.resize(nj);
+        work.resize(9 * (size_t)std::max(ni, nj));
+
+        // angles stepped the same way as the node counts them
+        float s = sp.smin;
+        for (int i = 0; i < ni; ++i)
+        {
+            columns.angle[i] = s;
+            s += sp.sd;
+        }
+
+        float o = sp.omin;
+        for (int j = 0; j < nj; ++j)
+        {
+            rows[j].angle = o;
+            o += sp.od;
+        }
+    }
+
+    if (dirty & kShellSection) PrepareSection(sp);
+    if (dirty & kShellRibs) PrepareRibs(sp);
+    if (dirty & (kShellSection | kShellRibs))
+    {
+        for (int i = 0; i < ni; ++i)
+        {
+            columns.radius[i] = columns.ellipse[i] + columns.ribs[i];
+        }
+    }
+    if (dirty & kShellNodules) PrepareNodules(sp);
+    if (dirty & kShellFrame) PrepareFrame(sp);
+}
+
+void ShellGrid::PrepareSection(const ShellParams& sp)
+{
+    const int ni = Columns();
+    float *ss = &work[0];
+    float *cs = ss + ni;
+    ShellSinCos(columns.angle.data(), ss, cs, ni, fastMath);
+    for (int i = 0; i < ni; ++i)
+    {
+        columns.ellipse[i] = 1.f / sqrtf(cs[i] * cs[i] / (sp.a*sp.a)
+            + ss[i] * ss[i] / (sp.b * sp.b));
+    }
+}
+
+void ShellGrid::PrepareRibs(const ShellParams& sp)
+{
+    const int ni = Columns();
+
+    // the profile rib is evaluated at v = 0 for every point
+    const float zv = sp.vamp ? rib(sp.vamp, sp.vrib, 1.f) : 0.f;
+    if (!sp.uamp)
+    {
+        std::fill(columns.ribs.begin(), columns.ribs.end(), zv);
+        return;
+    }
+
+    float *arg = &work[0];
+    float *srib = arg + ni;
+    float *crib = srib + ni;
+    for (int i = 0; i < ni; ++i)
+    {
+        arg[i] = 2.f * FPI * sp.ufreq * columns.angle[i];
+    }
+    ShellSinCos(arg, srib, crib, ni, fastMath);
+    for (int i = 0; i < ni; ++i)
+    {
+        columns.ribs[i] = rib(sp.uamp, sp.urib, crib[i]) + zv;
+    }
+}
+
+void ShellGrid::PrepareNodules(const ShellParams& sp)
+{
+    // same switches as Nodules. a nodule that is off skips its gaussians, a zero width
+    // would hand exp a nan argument, and its tables are zeroed
+    const bool on[3] = {
+        sp.L && sp.N && sp.W1 && sp.W2,
+        sp.L2 && sp.N2 && sp.W12 && sp.W22,
+        sp.L3 && sp.N3 && sp.W13 && sp.W23 };
+
+    const float P[3] = { sp.P, sp.P2, sp.P3 };
+    const float W1[3] = { sp.W1, sp.W12, sp.W13 };
+    const float W2[3] = { sp.W2, sp.W22, sp.W23 };
+    const float N[3] = { sp.N, sp.N2, sp.N3 };
+    const float off[3] = { 0.f, sp.off2, sp.off3 };
+
+    // gaussian of each nodule along the section
+    const int ni = Columns();
+    float *arg = &work[0];
+    for (int k = 0; k < 3; ++k)
+    {
+        if (!on[k])
+        {
+            std::fill(columns.nodule[k].begin(), columns.nodule[k].end(), 0.f);
+            continue;
+        }
+        for (int i = 0; i < ni; ++i)
+        {
+            const float p2 = (columns.angle[i] - P[k]) / W1[k];
+            arg[i] = -4.f * p2 * p2;
+        }
+        ShellExp(arg, columns.nodule[k].data(), ni, fastMath);
+    }
+
+    // and along the spiral
+    const int nj = Rows();
+    for (int k = 0; k < 3; ++k)
+    {
+        float *rarg = arg + k * nj;
+        if (!on[k])
+        {
+            std::fill(rarg, rarg + nj, 0.f);
+            continue;
+        }
+        for (int j = 0; j < nj; ++j)
+        {
+            const float p1 = G(rows[j].angle + off[k], N[k]) / W2[k];
+            rarg[j] = -4.f * p1 * p1;
+        }
+        ShellExp(rarg, rarg, nj, fastMath);
+    }
+
+    for (int j = 0; j < nj; ++j)
+    {
+        Row& r = rows[j];
+
+        // same activation as Nodules, an active second nodule also replaces the first
+        // one with its own gaussian scaled by L
+        const bool first = on[0] && r.angle >= sp.nstart;
+        const bool second = on[1] && r.angle >= sp.nstart2;
+        const bool third = on[2] && r.angle >= sp.nstart3;
+
+        r.nodule[0] = first && !second ? sp.L * arg[j] : 0.f;
+        r.nodule[1] = second ? (sp.L + sp.L2) * arg[nj + j] : 0.f;
+        r.nodule[2] = third ? sp.L3 * arg[2 * nj + j] : 0.f;
+    }
+}
+
+void ShellGrid::PrepareFrame(const ShellParams& sp)
+{
+    const float sbeta = sinf(sp.beta);
+    const float smy = sinf(sp.my);
+    const float cmy = cosf(sp.my);
+    const float cotAlpha = SafeCot(sp.alpha);
+    zOffset = -sp.A * cosf(sp.beta);
+
+    // section placement, one entry per column
+    const int ni = Columns();
+    float *arg = &work[0];
+    float *ssphi = arg + ni;
+    float *csphi = ssphi + ni;
+    for (int i = 0; i < ni; ++i)
+    {
+        arg[i] = columns.angle[i] + sp.phi;
+    }
+    ShellSinCos(arg, ssphi, csphi, ni, fastMath);
+    for (int i = 0; i < ni; ++i)
+    {
+        columns.csphi[i] = csphi[i];
+        columns.slant[i] = smy * ssphi[i];
+        columns.height[i] = cmy * ssphi[i];
+    }
+
+    // spiral, one entry per row
+    const int nj = Rows();
+    float *so = &work[0];
+    float *co = so + nj;
+    float *arg_omega = co + nj;
+    float *soo = arg_omega + nj;
+    float *coo = soo + nj;
+    float *arg_scale = coo + nj;
+    float *scale = arg_scale + nj;
+    float *angle = scale + nj;
+    for (int j = 0; j < nj; ++j)
+    {
+        angle[j] = rows[j].angle;
+        arg_omega[j] = rows[j].angle + sp.omega;
+        arg_scale[j] = rows[j].angle * cotAlpha;
+    }
+    ShellSinCos(angle, so, co, nj, fastMath);
+    ShellSinCos(arg_omega, soo, coo, nj, fastMath);
+    ShellExp(arg_scale, scale, nj, fastMath);
+
+    for (int j = 0; j < nj; ++j)
+    {
+        Row& r = rows[j];
+        r.co = co[j];
+        r.so = so[j];
+        r.coo = coo[j];
+        r.soo = soo[j];
+        r.axis = sp.A * sbeta * r.co;
+        r.scale = sp.scale * scale[j];
+    }
+}
+
+void ShellGrid::EvalRow(int j, float *p) const
+{
+    const Row& r = rows[j];
+    const int ni = Columns();
+    int i = 0;
+#ifdef SHELL_X86
+    if (avx2_enabled) i = EvalRowAVX2(j, p);
+#endif
+
+    // the vector path runs the same operations in the same order
+    for (p += 4 * i; i < ni; ++i, p += 4)
+    {
+        float radius = columns.radius[i] + r.nodule[0] * columns.nodule[0][i]
+            + r.nodule[1] * columns.nodule[1][i] + r.nodule[2] * columns.nodule[2][i];
+
+        float x = r.axis + radius * (columns.csphi[i] * r.coo - columns.slant[i] * r.so);
+        float y = r.axis + radius * (columns.csphi[i] * r.soo - columns.slant[i] * r.co);
+        float z = zOffset + radius * columns.height[i];
+
+        p[0] = x * r.scale;
+        p[1] = -z * r.scale;
+        p[2] = y * r.scale;
+        p[3] = 1.f;
+    }
+}
+
+#ifdef SHELL_X86
+SHELL_AVX2_TARGET int ShellGrid::EvalRowAVX2(int j, float *p) const
+{
+    const Row& r = rows[j];
+    const int n = Columns() & ~7;
+    const __m256 n0 = _mm256_set1_ps(r.nodule[0]);
+    const __m256 n1 = _mm256_set1_ps(r.nodule[1]);
+    const __m256 n2 = _mm256_set1_ps(r.nodule[2]);
+    const __m256 axis = _mm256_set1_ps(r.axis);
+    const __m256 co = _mm256_set1_ps(r.co);
+    const __m256 so = _mm256_set1_ps(r.so);
+    const __m256 coo = _mm256_set1_ps(r.coo);
+    const __m256 soo = _mm256_set1_ps(r.soo);
+    const __m256 scale = _mm256_set1_ps(r.scale);
+    const __m256 z_offset = _mm256_set1_ps(zOffset);
+    const __m256 sign = _mm256_set1_ps(-0.f);
+
+    for (int i = 0; i < n; i += 8, p += 32)
+    {
+        __m256 radius = _mm256_loadu_ps(&columns.radius[i]);
+        radius = _mm256_add_ps(radius, _mm256_mul_ps(n0, _mm256_loadu_ps(&columns.nodule[0][i])));
+        radius = _mm256_add_ps(radius, _mm256_mul_ps(n1, _mm256_loadu_ps(&columns.nodule[1][i])));
+        radius = _mm256_add_ps(radius, _mm256_mul_ps(n2, _mm256_loadu_ps(&columns.nodule[2][i])));
+
+        const __m256 csphi = _mm256_loadu_ps(&columns.csphi[i]);
+        const __m256 slant = _mm256_loadu_ps(&columns.slant[i]);
+        __m256 x = _mm256_sub_ps(_mm256_mul_ps(csphi, coo), _mm256_mul_ps(slant, so));
+        __m256 y = _mm256_sub_ps(_mm256_mul_ps(csphi, soo), _mm256_mul_ps(slant, co));
+        x = _mm256_add_ps(axis, _mm256_mul_ps(radius, x));
+        y = _mm256_add_ps(axis, _mm256_mul_ps(radius, y));
+        __m256 z = _mm256_add_ps(z_offset, _mm256_mul_ps(radius, _mm256_loadu_ps(&columns.height[i])));
+
+        x = _mm256_mul_ps(x, scale);
+        z = _mm256_mul_ps(_mm256_xor_ps(z, sign), scale);
+        y = _mm256_mul_ps(y, scale);
+
+        // x, -z, y, 1 planes to points, 4 per 128 bit half
+        for (int half = 0; half < 2; ++half)
+        {
+            __m128 a = half ? _mm256_extractf128_ps(x, 1) : _mm256_castps256_ps128(x);
+            __m128 b = half ? _mm256_extractf128_ps(z, 1) : _mm256_castps256_ps128(z);
+            __m128 c = half ? _mm256_extractf128_ps(y, 1) : _mm256_castps256_ps128(y);
+            __m128 d = _mm_set1_ps(1.f);
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+            float *q = p + 16 * half;
+            _mm_storeu_ps(q, a);
+            _mm_storeu_ps(q + 4, b);
+            _mm_storeu_ps(q + 8, c);
+            _mm_storeu_ps(q + 12, d);
+        }
+    }
+    return n;
+}
+#else
+int ShellGrid::EvalRowAVX2(int, float *) const
+{
+    return 0;
+}
+#endif
+
+int ShellGrid::RowGrain() const
+{
+    const size_t table_bytes = columns.radius.size() * 7 * sizeof(float);
+    const size_t row_bytes = std::max<size_t>(1, columns.radius.size() * 4 * sizeof(float));
+    if (table_bytes + row_bytes >= SHELL_L2_BYTES) return 1;
+    return (int)((SHELL_L2_BYTES - table_bytes) / row_bytes);
+}
+
+
+static bool cpu_has_avx2()
+{
+#if defined(SHELL_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    // avx state saved by the os
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(SHELL_X86)
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+
+static float rib(float amp, float percent, float c)
+{
+    float z = amp * c;
+    if (z < 0) z *= (1.f - 2.f * percent);
+    return z;
+}
+
+static void fast_sincos(float x, float& s, float& c)
+{
+    const float k = floorf(x * SHELL_2_OVER_PI + 0.5f);
+    const float r = ((x - k * SHELL_PI_2_HI) - k * SHELL_PI_2_MID) - k * SHELL_PI_2_LO;
+    const float r2 = r * r;
+    const float ps = r + r * r2 * ((SHELL_SIN_1 * r2 + SHELL_SIN_2) * r2 + SHELL_SIN_3);
+    const float pc = (1.f - 0.5f * r2) + r2 * r2 * ((SHELL_COS_1 * r2 + SHELL_COS_2) * r2 + SHELL_COS_3);
+
+    // quadrant swaps the polynomials and flips their signs
+    const int q = (int)k;
+    s = (q & 1) ? pc : ps;
+    c = (q & 1) ? ps : pc;
+    if (q & 2) s = -s;
+    if ((q + 1) & 2) c = -c;
+}
+
+static float fast_exp(float x)
+{
+    // 0 under the range like libm past its underflow, a tiny gaussian tail would
+    // make denormal products in EvalRow
+    if (x < SHELL_EXP_MIN) return 0.f;
+    x = std::min(x, SHELL_EXP_MAX);
+    const float k = floorf(x * SHELL_LOG2E + 0.5f);
+    const float r = (x - k * SHELL_LN2_HI) - k * SHELL_LN2_LO;
+    float p = ((((SHELL_EXP_1 * r + SHELL_EXP_2) * r + SHELL_EXP_3) * r + SHELL_EXP_4) * r
+        + SHELL_EXP_5) * r + SHELL_EXP_6;
+    p = (p * (r * r) + r) + 1.f;
+
+    const int bits = ((int)k + 127) << 23;
+    float two_k;
+    memcpy(&two_k, &bits, sizeof(float));
+    return p * two_k;
+}
+
+#ifdef SHELL_X86
+SHELL_AVX2_TARGET static int sincos_avx2(const float *x, float *s, float *c, int n)
+{
+    const int count = n & ~7;
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+    for (int i = 0; i < count; i += 8)
+    {
+        const __m256 v = _mm256_loadu_ps(x + i);
+        const __m256 k = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(SHELL_2_OVER_PI)),
+            _mm256_set1_ps(0.5f)));
+        __m256 r = _mm256_sub_ps(v, _mm256_mul_ps(k, _mm256_set1_ps(SHELL_PI_2_HI)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(SHELL_PI_2_MID)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(SHELL_PI_2_LO)));
+        const __m256 r2 = _mm256_mul_ps(r, r);
+
+        __m256 ps = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SHELL_SIN_1), r2), _mm256_set1_ps(SHELL_SIN_2));
+        ps = _mm256_add_ps(_mm256_mul_ps(ps, r2), _mm256_set1_ps(SHELL_SIN_3));
+        ps = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), ps));
+
+        __m256 pc = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SHELL_COS_1), r2), _mm256_set1_ps(SHELL_COS_2));
+        pc = _mm256_add_ps(_mm256_mul_ps(pc, r2), _mm256_set1_ps(SHELL_COS_3));
+        pc = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)),
+            _mm256_mul_ps(_mm256_mul_ps(r2, r2), pc));
+
+        const __m256i q = _mm256_cvttps_epi32(k);
+        const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, one), one));
+        const __m256 flip_s = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, two), 30));
+        const __m256 flip_c = _mm256_castsi256_ps(_mm256_slli_epi32(
+            _mm256_and_si256(_mm256_add_epi32(q, one), two), 30));
+
+        _mm256_storeu_ps(s + i, _mm256_xor_ps(_mm256_blendv_ps(ps, pc, swap), _mm256_and_ps(flip_s, sign)));
+        _mm256_storeu_ps(c + i, _mm256_xor_ps(_mm256_blendv_ps(pc, ps, swap), _mm256_and_ps(flip_c, sign)));
+    }
+    return count;
+}
+
+SHELL_AVX2_TARGET static int exp_avx2(const float *x, float *e, int n)
+{
+    const int count = n & ~7;
+    for (int i = 0; i < count; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(x + i);
+        const __m256 under = _mm256_cmp_ps(v, _mm256_set1_ps(SHELL_EXP_MIN), _CMP_LT_OQ);
+        v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(SHELL_EXP_MIN)), _mm256_set1_ps(SHELL_EXP_MAX));
+        const __m256 k = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(SHELL_LOG2E)),
+            _mm256_set1_ps(0.5f)));
+        __m256 r = _mm256_sub_ps(v, _mm256_mul_ps(k, _mm256_set1_ps(SHELL_LN2_HI)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(SHELL_LN2_LO)));
+
+        __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SHELL_EXP_1), r), _mm256_set1_ps(SHELL_EXP_2));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(SHELL_EXP_3));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(SHELL_EXP_4));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(SHELL_EXP_5));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(SHELL_EXP_6));
+        p = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p, _mm256_mul_ps(r, r)), r), _mm256_set1_ps(1.f));
+
+        const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(k),
+            _mm256_set1_epi32(127)), 23);
+        _mm256_storeu_ps(e + i, _mm256_andnot_ps(under, _mm256_mul_ps(p, _mm256_castsi256_ps(bits))));
+    }
+    return count;
+}
+#endif
@@ -0,0 +1,165 @@
+#ifndef SHELL_EVAL_H
+#define SHELL_EVAL_H
+
+#include <vector>
+
+/*
+Shell surface math, independent from the Maya API so it can be timed and
+checked outside of the node.
+Eval computes one point from scratch, every sin, cos and exp per point.
+ShellGrid splits the same formula in factors that only depend on the
+section angle s (one table entry per column) or on the spiral angle o (one
+per row), the nodule gaussians included since exp(-4(a + b)) is
+exp(-4a) exp(-4b). A grid point is then a handful of multiply-adds.
+The tables are kept in layers, see ShellLayer, so a parameter change only
+recomputes the tables reading it before the rows are combined again.
+Rows only read the tables, any split of them across threads gives the
+same bits as the serial loop.
+With AVX2 a row is combined 8 columns at a time. The sin, cos and exp of the
+tables run as batches, through libm or, in fast mode, through polynomials
+that are also 8 wide with AVX2. The vector and scalar code do the same float
+operations in the same order, so both give the same bits. Builds that
+enable FMA for the whole file (-march=native) need -ffp-contract=off to keep
+that.
+Fast mode max error against double precision, checked by shell_bench:
+  sin, cos   1.5e-7 absolute for |x| < 100, shell angles stay well below
+  exp        1.5e-7 relative for x in [-87, 88], 0 below, clamped above
+*/
+
+struct ShellParams
+{
+    float alpha;
+    float beta;
+    float phi;
+    float my;
+    float omega;
+    float omin;
+    float omax;
+    float od;
+    float smin;
+    float smax;
+    float sd;
+    float A;
+    float a;
+    float b;
+    float scale;
+
+    // nodule 1
+    float P;
+    float L;
+    float N;
+    float W1;
+    float W2;
+    float nstart;
+
+    // nodule 2
+    float L2;
+    float P2;
+    float N2;
+    float W12;
+    float W22;
+    float off2;
+    float nstart2;
+
+    // nodule 3
+    float L3;
+    float P3;
+    float N3;
+    float W13;
+    float W23;
+    float off3;
+    float nstart3;
+
+    // ribs
+    float uamp;
+    float ufreq;
+    float urib;
+    float vamp;
+    float vfreq;
+    float vrib;
+};
+
+// direct evaluation of one point at spiral angle o and section angle s
+float Nodules(const ShellParams& sp, float s, float o);
+float Ribs(const ShellParams& sp, float u, float v);
+void Eval(const ShellParams& sp, float *p, float o, float s);
+
+// tables grouped by the parameters they read, a change only dirties the layers
+// reading it. the steps, ranges and fast mode change every layer
+enum ShellLayer
+{
+    kShellSection = 1 << 0,  // ellipse radius: a, b
+    kShellRibs = 1 << 1,     // rib radius: uamp, ufreq, urib, vamp, vfreq, vrib
+    kShellNodules = 1 << 2,  // nodule gaussians: P, L, N, W, off, nstart of each
+    kShellFrame = 1 << 3,    // section placement and spiral: alpha, beta, phi, my, omega, A, scale
+    kShellAll = 0xf
+};
+
+// sin and cos, or exp, of n floats, libm when fast is off
+void ShellSinCos(const float *x, float *s, float *c, int n, bool fast);
+void ShellExp(const float *x, float *e, int n, bool fast);
+
+// the AVX2 paths are taken when the cpu has it, disabling them is for comparisons
+bool ShellAVX2Enabled();
+void ShellEnableAVX2(bool enable);
+
+class ShellGrid
+{
+public:
+    ShellGrid() {}
+
+    // factor tables of ni section angles from smin and nj spiral angles from omin,
+    // stepped the same way as the node counts them. only the dirty layers are
+    // recomputed, all of them when the grid size or fast mode changes
+    void Prepare(const ShellParams& sp, int ni, int nj, bool fast=false, unsigned dirty=kShellAll);
+
+    // the ni points of spiral row j, x y z and w = 1 each, the MFloatPoint layout
+    void EvalRow(int j, float *p) const;
+
+    // rows per parallel task, so the column table and the rows written by one task stay in l2
+    int RowGrain() const;
+
+    int Columns() const { return (int)columns.radius.size(); }
+    int Rows() const { return (int)rows.size(); }
+
+private:
+    void PrepareSection(const ShellParams& sp);
+    void PrepareRibs(const ShellParams& sp);
+    void PrepareNodules(const ShellParams& sp);
+    void PrepareFrame(const ShellParams& sp);
+    int EvalRowAVX2(int j, float *p) const;
+
+    // one entry per column, each term in its own array for 8 wide loads
+    struct ColumnTable
+    {
+        std::vector<float> angle;      // s
+        std::vector<float> ellipse;    // section layer
+        std::vector<float> ribs;       // rib layer
+        std::vector<float> radius;     // ellipse plus ribs
+        std::vector<float> csphi;      // cos(s + phi)
+        std::vector<float> slant;      // sin(my) sin(s + phi)
+        std::vector<float> height;     // cos(my) sin(s + phi)
+        std::vector<float> nodule[3];  // gaussian of each nodule along the section
+    };
+
+    struct Row
+    {
+        float angle;      // o
+        float axis;       // A sin(beta) cos(o)
+        float co;         // cos(o)
+        float so;         // sin(o)
+        float coo;        // cos(o + omega)
+        float soo;        // sin(o + omega)
+        float scale;      // scale exp(o cot(alpha))
+        float nodule[3];  // amplitude times gaussian along the spiral, 0 where inactive
+    };
+
+    ColumnTable columns;
+    std::vector<Row> rows;
+    float zOffset=0.f;  // -A cos(beta)
+    bool fastMath=false;
+    bool prepared=false;
+    std::vector<float> work;  // sin, cos and exp batches
+};
+
+#endif // !SHELL_EVAL_H
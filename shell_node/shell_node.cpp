@@ -17,10 +17,16 @@
 
 #include <maya/MFnMesh.h>
 #include <maya/MFnMeshData.h>
-#include <maya/MItMeshVertex.h>
 #include <math.h>
+#include <stdlib.h>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
 #include <maya/MIOStream.h>
 
+#include "../common/parallelFor.h"
+#include "shell_eval.h"
+
 #define Rad(x) ((x)*FPI/180.0f)
 #define Deg(x) ((x)*180.0F/FPI)
 #define FPI 3.14159265358979323846264338327950288419716939937510582f
@@ -98,70 +104,26 @@ public:
     static MObject vfreq;
     static MObject vrib;
 
+    // libm or the polynomial sin, cos and exp of shell_eval.h
+    static MObject fastMath;
+
     // output mesh
     static MObject outMesh;
 
 private:
-    struct ShellParams {
-        float alpha;
-        float beta;
-        float phi;
-        float my;
-        float omega;
-        float omin;
-        float omax;
-        float od;
-        float smin;
-        float smax;
-        float sd;
-        float A;
-        float a;
-        float b;
-        float scale;
-
-        // nodule 1
-        float P;
-        float L;
-        float N;
-        float W1;
-        float W2;
-        float nstart;
-
-        // nodule 2
-        float L2;
-        float P2;
-        float N2;
-        float W12;
-        float W22;
-        float off2;
-        float nstart2;
-
-        // nodule 3
-        float L3;
-        float P3;
-        float N3;
-        float W13;
-        float W23;
-        float off3;
-        float nstart3;
-
-        // ribs
-        float uamp;
-        float ufreq;
-        float urib;
-        float vamp;
-        float vfreq;
-        float vrib;
-    };
     ShellParams shellParams;
+    ShellGrid grid;
+    bool useFastMath=false;
+    unsigned dirtyLayers=kShellAll;  // ShellLayer bits changed since the last Rebuild
 
     bool redoTopology;
     bool rebuild;
 
-    // precompute shell points
+    // precompute shell points, one 64 byte aligned slab of nj rows of ni
+    // MFloatPoint (x y z w) so it is handed to the mesh in one copy
     int ni;
     int nj;
-    float **pnts;
+    float *pnts;
 
 private:
     float GetFloatParameter(MObject node, MObject attr);
@@ -170,13 +132,15 @@ private:
         MString briefName, float attrDefault);
     static void addAngleParameter(MObject& attr, MString longName,
         MString briefName, float attrDefault);
+    static void addBoolParameter(MObject& attr, MString longName,
+        MString briefName, bool attrDefault);
+
+    static float* AllocPoints(int count);
+    static void FreePoints(float *points);
 
     void UpdateParameters();
     void RedoTopology();
     void Rebuild();
-    float Nodules(float s, float o);
-    float Ribs(float u, float v);
-    void Eval(float *p, float o, float s);
 
 };
 
@@ -185,7 +149,10 @@ MTypeId shellNode::id(0x8000b);
 shellNode::shellNode() : redoTopology(true), pnts(NULL), ni(0), nj(0), rebuild(true)
 {}
 
-shellNode::~shellNode() {}
+shellNode::~shellNode()
+{
+    FreePoints(pnts);
+}
 
 MStatus shellNode::compute(const MPlug& plug, MDataBlock& data)
 {
@@ -214,16 +181,8 @@ MStatus shellNode::compute(const MPlug& plug, MDataBlock& data)
             MObject newOutputData = dataCreator.create(&returnStatus);
             McheckErr(returnStatus, "ERROR creating outputData");
 
-            MFloatPointArray vertices;
-
             // build vertices array
-            for (j = 0; j < nj; ++j) {
-                for (i = 0; i < ni; ++i)
-                {
-                    const float *p = pnts[j] + 3 * i;
-                    vertices.append(MFloatPoint(p[0], p[1], p[2]));
-                }
-            }
+            MFloatPointArray vertices((const float(*)[4])pnts, ni * nj);
 
             // build poly vertex count array
             MIntArray pcounts;
@@ -235,7 +194,7 @@ MStatus shellNode::compute(const MPlug& plug, MDataBlock& data)
 
             // build poly connectivity array
             MIntArray pconnect;
-            for (j = 0; j < nj; ++i)
+            for (j = 0; j < nj - 1; ++j)
             {
                 for (i = 0; i < ni - 1; ++i)
                 {
@@ -270,20 +229,12 @@ MStatus shellNode::compute(const MPlug& plug, MDataBlock& data)
         else
         {
             // The topology hasn't changed, so we can just set the points in the existing mesh
-            MItMeshVertex vertIt(mesh, &returnStatus);
-            McheckErr(returnStatus, "ERROR creating iterator.\n");
+            MFnMesh meshFn(mesh, &returnStatus);
+            McheckErr(returnStatus, "ERROR attaching mesh function set.\n");
 
-            for (j = 0; j < nj; ++j)
-            {
-                for (i = 0; i < ni; ++i)
-                {
-                    if (vertIt.isDone()) break;
-                    const float *p = pnts[j] + 3 * i;
-                    vertIt.setPosition(MPoint(p[0], p[1], p[2]));
-                    vertIt.next();
-                }
-                if (vertIt.isDone()) break;
-            }
+            MFloatPointArray vertices((const float(*)[4])pnts, ni * nj);
+            returnStatus = meshFn.setPoints(vertices);
+            McheckErr(returnStatus, "ERROR setting points.\n");
         }
         data.setClean(plug);
     }
@@ -297,13 +248,34 @@ void* shellNode::creator()
 }
 
 // Shell Algorithms
+float* shellNode::AllocPoints(int count)
+{
+    // 64 byte aligned, every cache line holds 4 whole points
+    size_t bytes = (size_t)(count > 0 ? count : 1) * 4 * sizeof(float);
+#if defined(_MSC_VER)
+    return static_cast<float*>(_aligned_malloc(bytes, 64));
+#else
+    void *data = nullptr;
+    return posix_memalign(&data, 64, bytes) == 0 ? static_cast<float*>(data) : nullptr;
+#endif
+}
+
+void shellNode::FreePoints(float *points)
+{
+#if defined(_MSC_VER)
+    _aligned_free(points);
+#else
+    free(points);
+#endif
+}
+
 void shellNode::RedoTopology()
 {
     if (!redoTopology) return;
 
     redoTopology = false;
 
-    int oldnj = pnts ? nj : 0;
+    int oldCount = pnts ? ni * nj : 0;
     ni = 0;
     nj = 0;
     for (float s = shellParams.smin;
@@ -320,38 +292,17 @@ void shellNode::RedoTopology()
         nj++;
     }
 
-    if (nj < oldnj)
+    if (ni * nj != oldCount)
     {
-        for (int i = nj; i < oldnj; ++i)
+        FreePoints(pnts);
+        pnts = AllocPoints(ni * nj);
+        if (!pnts)
         {
-            if (pnts[i]) free(pnts[i]);
+            ni = 0;
+            nj = 0;
+            return; // allocation error
         }
     }
-
-    if (nj != oldnj)
-    {
-        float **new_data = static_cast<float**>(realloc(pnts, nj * sizeof(float*)));
-        if (new_data == nullptr)
-        {
-            delete pnts;
-            pnts = nullptr;
-            return; // allocation error, crash is imminent!
-        }
-        else
-        {
-            pnts = new_data;
-        }
-    }
-
-    if (nj > oldnj)
-    {
-        memset(pnts + oldnj, 0, (nj - oldnj) * sizeof(float*));
-    }
-
-    for (int j = 0; j < nj; ++j)
-    {
-        pnts[j] = (float*)realloc(pnts[j], 3 * ni * sizeof(float));
-    }
 }
 
 void shellNode::Rebuild()
@@ -361,135 +312,16 @@ void shellNode::Rebuild()
     if (!rebuild) return;
     rebuild = 0;
 
-    int i;
-    int j;
-    int s;
-    int o;
-    float *p;
-
-    o = shellParams.omin;
-    for (j = 0; j < nj; ++j)
-    {
-        s = shellParams.smin;
-        p = pnts[j];
-        for (i = 0; i < ni; ++i)
+    // sin, cos and exp once per column and per row, the grid itself is multiply-adds
+    // rows are independent, chunks of them run across the cores
+    grid.Prepare(shellParams, ni, nj, useFastMath, dirtyLayers);
+    dirtyLayers = 0;
+    parallel_for(0, nj, grid.RowGrain(), [&](int begin, int end) {
+        for (int j = begin; j < end; ++j)
         {
-            Eval(p, o, s);  // method 
-            s += shellParams.sd;
-            p += 3;
+            grid.EvalRow(j, pnts + 4 * (size_t)j * ni);
         }
-
-        o += shellParams.od;
-    }
-}
-
-inline float SafeCot(float x)
-{
-    float s = sinf(x);
-    return s ? cosf(x) / s : 0.0f;
-}
-
-inline float G(float a, float n)
-{
-    if (!n) return n;
-    float z = 2.0f * FPI;
-    a *= n / z;
-    return z / n*(a - floorf(0.5f + a));
-}
-
-float shellNode::Ribs(float u, float v)
-{
-    ShellParams & sp = shellParams;
-
-    float zu = 0.f;
-    if (sp.uamp)
-    {
-        zu = sp.uamp * cosf(2.f * FPI * sp.ufreq * u);
-        if (zu < 0) zu *= (1.f - 2.f * sp.urib);
-    }
-    float zv = 0.f;
-    if (sp.vamp)
-    {
-        zv = sp.vamp * cosf(2.f * FPI * sp.vfreq * v);
-        if (zv < 0) zv *= (1.f - 2.f * sp.vrib);
-    }
-
-    return zu + zv;
-}
-
-float shellNode::Nodules(float s, float o)
-{
-    ShellParams & sp = shellParams;  // reference to shellParams
-
-    float p1;
-    float p2;
-    float k = 0.f;
-    float g = 0.f;
-
-    if (sp.L && sp.N && o >= sp.nstart)
-    {
-        g = G(o, sp.N);
-        p1 = g / sp.W2;
-        p2 = (s - sp.P) / sp.W1;
-        k = sp.L * expf(-4.f * (p1 * p1 + p2 * p2));
-    }
-
-    if (sp.L2 && sp.N2 && o >= sp.nstart2)
-    {
-        g = G(o + sp.off2, sp.N2);
-        p1 = g / sp.W22;
-        p2 = (s - sp.P2) / sp.W12;
-        k = sp.L * expf(-4.f * (p1*p1 + p2*p2));
-    }
-
-    if (sp.L2 && sp.N2 && o >= sp.nstart2)
-    {
-        g = G(o + sp.off2, sp.N2);
-        p1 = g / sp.W22;
-        p2 = (s - sp.P2) / sp.W12;
-        k += sp.L2 *expf(-4.f * (p1 * p1 + p2 * p2));
-    }
-
-    if (sp.L3 && sp.N3 && o >= sp.nstart3)
-    {
-        g = G(o + sp.off3, sp.N3);
-        p1 = g / sp.W23;
-        p2 = (s - sp.P3) / sp.W13;
-        k += sp.L3 * expf(-4.f * (p1*p1 + p2*p2));
-    }
-    return k;
-}
-
-void shellNode::Eval(float *p, float o, float s)
-{
-    ShellParams & sp = shellParams;
-
-    float ss = sinf(s);
-    float cs = cosf(s);
-    float re = 1.f / sqrtf(cs * cs / (sp.a*sp.a)
-        + ss*ss / (sp.b * sp.b));
-
-    float sc = sp.scale * expf(o * SafeCot(sp.alpha));
-    float csphi = cosf(s + sp.phi);
-    float ssphi = sinf(s + sp.phi);
-    float sbeta = sinf(sp.beta);
-    float smy = sinf(sp.my);
-    float r = re + Nodules(s, o) + Ribs(s, 0);
-
-    float x = sp.A * sbeta * cosf(o)
-        + r * csphi * cosf(o + sp.omega)
-        - r * smy * ssphi * sinf(o);
-
-    float y = sp.A * sbeta * cosf(o)
-        + r * csphi * sinf(o + sp.omega)
-        - r * smy * ssphi * cosf(o);
-
-    float z = -sp.A * cosf(sp.beta)
-        + r * ssphi * cosf(sp.my);
-
-    p[0] = x * sc;
-    p[1] = -z * sc;
-    p[2] = y * sc;
+    });
 }
 
 // Attribute setup and Maintance
@@ -544,6 +376,9 @@ MObject shellNode::vamp;  // Profile rib amplitude
 MObject shellNode::vfreq; // Profile rib frequency
 MObject shellNode::vrib;  // profile rib/wave percent
 
+// Evaluation
+MObject shellNode::fastMath; // polynomial sin, cos and exp
+
 // Output mesh
 MObject shellNode::outMesh;
 
@@ -604,6 +439,28 @@ void shellNode::addAngleParameter(MObject& attr, MString longName,
     if (stat != MS::kSuccess) throw stat;
 }
 
+void shellNode::addBoolParameter(MObject& attr, MString longName,
+    MString briefName, bool attrDefault)
+{
+    // add a boolean input parameter to the node
+    MStatus stat;
+    MFnNumericAttribute nAttr;
+    attr = nAttr.create(longName, briefName, MFnNumericData::kBoolean, attrDefault, &stat);
+    if (stat != MS::kSuccess) throw stat;
+
+    stat = nAttr.setKeyable(true);
+    if (stat != MS::kSuccess) throw stat;
+
+    stat = nAttr.setStorable(true);
+    if (stat != MS::kSuccess) throw stat;
+
+    stat = addAttribute(attr);
+    if (stat != MS::kSuccess) throw stat;
+
+    stat = attributeAffects(attr, outMesh);
+    if (stat != MS::kSuccess) throw stat;
+}
+
 MStatus shellNode::initialize()
 {
     // setup node attributes
@@ -659,7 +516,7 @@ MStatus shellNode::initialize()
         addAngleParameter(P3, "positionOnSection3", "ps3", 0.f);
         addFloatParameter(L3, "noduleAmplitude3", "na3", 0.f);
         addFloatParameter(N3, "noduleProfileFrequency3", "nf3", 0.f);
-        addAngleParameter(W12, "noduleFatness13", "f13", 30.f);
+        addAngleParameter(W13, "noduleFatness13", "f13", 30.f);
         addAngleParameter(W23, "noduleFatness23", "f23", 30.f);
         addAngleParameter(off3, "noduleOffset3", "no3", 0.f);
         addAngleParameter(nstart3, "spiralStartingPoint3", "sp3", 0.f);
@@ -670,6 +527,8 @@ MStatus shellNode::initialize()
         addFloatParameter(vamp, "profileRibAmplitude", "pra", 0.f);
         addFloatParameter(vfreq, "profileRibFrequency", "prf", 0.f);
         addFloatParameter(vrib, "profileRibWavePercent", "prw", 0.f);
+
+        addBoolParameter(fastMath, "fastMath", "fm", false);
     }
     catch (MStatus stat) {
         fprintf(stderr, "Attribute Initialize failed\n");
@@ -694,19 +553,21 @@ inline float shellNode::GetAngleParameter(MObject node, MObject attr)
     return (float)angle.asRadians();
 }
 
-#define UpdateFloatAttr(ATTR, TOPOLOGY)                   \
+#define UpdateFloatAttr(ATTR, TOPOLOGY, LAYERS)           \
     oldValue = shellParams. ATTR;                         \
     shellParams. ATTR = GetFloatParameter(thisObj, ATTR); \
     if (shellParams. ATTR != oldValue){                   \
         rebuild = true;                                   \
+        dirtyLayers |= LAYERS;                            \
         redoTopology = TOPOLOGY ? true : redoTopology;    \
     }
 
-#define UpdateAngleAttr(ATTR, TOPOLOGY)                   \
+#define UpdateAngleAttr(ATTR, TOPOLOGY, LAYERS)           \
     oldValue = shellParams. ATTR;                         \
     shellParams. ATTR = GetAngleParameter(thisObj, ATTR); \
     if (shellParams. ATTR != oldValue){                   \
     rebuild = true;                                       \
+    dirtyLayers |= LAYERS;                                \
     redoTopology = TOPOLOGY ? true : redoTopology;        \
     }
 
@@ -718,50 +579,58 @@ void shellNode::UpdateParameters()
     MObject thisObj = thisMObject();
     float oldValue;
 
-    UpdateAngleAttr(alpha, false);
-    UpdateAngleAttr(beta, false);
-    UpdateAngleAttr(phi, false);
-    UpdateAngleAttr(my, false);
-    UpdateAngleAttr(omega, false);
-    UpdateFloatAttr(A, false);
-    UpdateFloatAttr(a, false);
-    UpdateFloatAttr(b, false);
-    UpdateFloatAttr(scale, false);
-
-    UpdateAngleAttr(P, false);
-    UpdateFloatAttr(L, false);
-    UpdateFloatAttr(N, false);
-    UpdateAngleAttr(W1, false);
-    UpdateAngleAttr(W2, false);
-    UpdateAngleAttr(nstart, false);
-    UpdateAngleAttr(P2, false);
-    UpdateFloatAttr(L2, false);
-    UpdateFloatAttr(N2, false);
-    UpdateAngleAttr(W12, false);
-    UpdateAngleAttr(W22, false);
-    UpdateAngleAttr(off2, false);
-    UpdateAngleAttr(nstart2, false);
-    UpdateAngleAttr(P3, false);
-    UpdateFloatAttr(L3, false);
-    UpdateFloatAttr(N3, false);
-    UpdateAngleAttr(W13, false);
-    UpdateAngleAttr(W23, false);
-    UpdateAngleAttr(off3, false);
-    UpdateAngleAttr(nstart3, false);
-    UpdateFloatAttr(uamp, false);
-    UpdateFloatAttr(ufreq, false);
-    UpdateFloatAttr(urib, false);
-    UpdateFloatAttr(vamp, false);
-    UpdateFloatAttr(vfreq, false);
-    UpdateFloatAttr(vrib, false);
+    UpdateAngleAttr(alpha, false, kShellFrame);
+    UpdateAngleAttr(beta, false, kShellFrame);
+    UpdateAngleAttr(phi, false, kShellFrame);
+    UpdateAngleAttr(my, false, kShellFrame);
+    UpdateAngleAttr(omega, false, kShellFrame);
+    UpdateFloatAttr(A, false, kShellFrame);
+    UpdateFloatAttr(a, false, kShellSection);
+    UpdateFloatAttr(b, false, kShellSection);
+    UpdateFloatAttr(scale, false, kShellFrame);
+
+    UpdateAngleAttr(P, false, kShellNodules);
+    UpdateFloatAttr(L, false, kShellNodules);
+    UpdateFloatAttr(N, false, kShellNodules);
+    UpdateAngleAttr(W1, false, kShellNodules);
+    UpdateAngleAttr(W2, false, kShellNodules);
+    UpdateAngleAttr(nstart, false, kShellNodules);
+    UpdateAngleAttr(P2, false, kShellNodules);
+    UpdateFloatAttr(L2, false, kShellNodules);
+    UpdateFloatAttr(N2, false, kShellNodules);
+    UpdateAngleAttr(W12, false, kShellNodules);
+    UpdateAngleAttr(W22, false, kShellNodules);
+    UpdateAngleAttr(off2, false, kShellNodules);
+    UpdateAngleAttr(nstart2, false, kShellNodules);
+    UpdateAngleAttr(P3, false, kShellNodules);
+    UpdateFloatAttr(L3, false, kShellNodules);
+    UpdateFloatAttr(N3, false, kShellNodules);
+    UpdateAngleAttr(W13, false, kShellNodules);
+    UpdateAngleAttr(W23, false, kShellNodules);
+    UpdateAngleAttr(off3, false, kShellNodules);
+    UpdateAngleAttr(nstart3, false, kShellNodules);
+    UpdateFloatAttr(uamp, false, kShellRibs);
+    UpdateFloatAttr(ufreq, false, kShellRibs);
+    UpdateFloatAttr(urib, false, kShellRibs);
+    UpdateFloatAttr(vamp, false, kShellRibs);
+    UpdateFloatAttr(vfreq, false, kShellRibs);
+    UpdateFloatAttr(vrib, false, kShellRibs);
+
+    bool oldFastMath = useFastMath;
+    useFastMath = MPlug(thisObj, fastMath).asBool();
+    if (useFastMath != oldFastMath)
+    {
+        rebuild = true;
+        dirtyLayers = kShellAll;
+    }
 
     // these settings change the topology of the geometry
-    UpdateAngleAttr(omin, true);
-    UpdateAngleAttr(omax, true);
-    UpdateAngleAttr(od, true);
-    UpdateAngleAttr(smin, true);
-    UpdateAngleAttr(smax, true);
-    UpdateAngleAttr(sd, true);
+    UpdateAngleAttr(omin, true, kShellAll);
+    UpdateAngleAttr(omax, true, kShellAll);
+    UpdateAngleAttr(od, true, kShellAll);
+    UpdateAngleAttr(smin, true, kShellAll);
+    UpdateAngleAttr(smax, true, kShellAll);
+    UpdateAngleAttr(sd, true, kShellAll);
 }
 
 // Plug-in Initialization
@@ -793,5 +662,8 @@ MStatus uninitializePlugin(MObject obj)
         return status;
     }
 
+    // no node is left to run chunks, join the workers before the plugin unloads
+    parallel_for_shutdown();
+
     return status;
 }
@@ -0,0 +1,236 @@
+#include "envelopeCholesky.h"
+
+#include <algorithm>
+#include <cmath>
+
+// breadth first sweeps used to find a pseudo peripheral start vertex
+#define RCM_PERIPHERAL_SWEEPS 2
+
+static int bfs_last_level(int start, const int* offsets, const int* neighbours,
+    std::vector<int>& level, int stamp, int& depth);
+
+void EnvelopeCholesky::clear()
+{
+    _order.clear();
+    _rank.clear();
+    _first.clear();
+    _row_start.clear();
+    _values.clear();
+    _offsets.clear();
+    _neighbours.clear();
+    _factored = false;
+}
+
+void EnvelopeCholesky::analyze(int n, const int* offsets, const int* neighbours)
+{
+    clear();
+    if (n <= 0) return;
+
+    _offsets.assign(offsets, offsets + n + 1);
+    _neighbours.assign(neighbours, neighbours + offsets[n]);
+
+    // cuthill-mckee, one component at a time from a vertex far from the others
+    std::vector<int> level(n, -1);
+    std::vector<char> visited(n, 0);
+    std::vector<int> sorted;
+    _order.reserve(n);
+    int stamp = 0;
+    for (int seed = 0; seed < n; ++seed)
+    {
+        if (visited[seed]) continue;
+
+        int start = seed;
+        int depth = 0;
+        for (int sweep = 0; sweep < RCM_PERIPHERAL_SWEEPS; ++sweep)
+        {
+            int last_depth = depth;
+            int candidate = bfs_last_level(start, offsets, neighbours, level, stamp++, depth);
+            if (sweep && depth <= last_depth) break;
+            start = candidate;
+        }
+
+        size_t head = _order.size();
+        _order.push_back(start);
+        visited[start] = 1;
+        for (; head < _order.size(); ++head)
+        {
+            const int v = _order[head];
+
+            // unvisited neighbours by increasing degree
+            sorted.clear();
+            for (int k = offsets[v]; k < offsets[v + 1]; ++k)
+            {
+                if (!visited[neighbours[k]]) sorted.push_back(neighbours[k]);
+            }
+            std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+                const int degree_a = offsets[a + 1] - offsets[a];
+                const int degree_b = offsets[b + 1] - offsets[b];
+                return degree_a < degree_b || (degree_a == degree_b && a < b);
+            });
+
+            for (size_t i = 0; i < sorted.size(); ++i)
+            {
+                visited[sorted[i]] = 1;
+                _order.push_back(sorted[i]);
+            }
+        }
+    }
+
+    // reversing the order shrinks the envelope, not the bandwidth
+    std::reverse(_order.begin(), _order.end());
+    _rank.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        _rank[_order[i]] = i;
+    }
+
+    // every row stores from its leftmost nonzero to the diagonal, L fills no further
+    _first.resize(n);
+    _row_start.resize(n + 1);
+    _row_start[0] = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        const int v = _order[i];
+        int first = i;
+        for (int k = offsets[v]; k < offsets[v + 1]; ++k)
+        {
+            first = std::min(first, _rank[neighbours[k]]);
+        }
+        _first[i] = first;
+        _row_start[i + 1] = _row_start[i] + (i - first + 1);
+    }
+    _values.resize(_row_start[n]);
+}
+
+bool EnvelopeCholesky::factor(const double* diagonal, const double* off_diagonal)
+{
+    _factored = false;
+    const int n = size();
+    if (!n) return false;
+
+    // scatter the lower triangle into the envelope
+    std::fill(_values.begin(), _values.end(), 0.0);
+    for (int v = 0; v < n; ++v)
+    {
+        const int i = _rank[v];
+        _values[_row_start[i + 1] - 1] = diagonal[v];
+        for (int k = _offsets[v]; k < _offsets[v + 1]; ++k)
+        {
+            const int j = _rank[_neighbours[k]];
+            if (j < i) _values[_row_start[i] + (j - _first[i])] = off_diagonal[k];
+        }
+    }
+
+    // row by row, each entry only needs the rows above it
+    for (int i = 0; i < n; ++i)
+    {
+        double* row_i = &_values[_row_start[i]];
+        const int first_i = _first[i];
+
+        for (int j = first_i; j < i; ++j)
+        {
+            const double* row_j = &_values[_row_start[j]];
+            const int first_j = _first[j];
+
+            double sum = row_i[j - first_i];
+            for (int k = std::max(first_i, first_j); k < j; ++k)
+            {
+                sum -= row_i[k - first_i] * row_j[k - first_j];
+            }
+            row_i[j - first_i] = sum / row_j[j - first_j];
+        }
+
+        double pivot = row_i[i - first_i];
+        for (int k = first_i; k < i; ++k)
+        {
+            pivot -= row_i[k - first_i] * row_i[k - first_i];
+        }
+        if (!(pivot > 0.0)) return false;
+        row_i[i - first_i] = sqrt(pivot);
+    }
+
+    _factored = true;
+    return true;
+}
+
+void EnvelopeCholesky::solve(double* b, std::vector<double>& work) const
+{
+    if (!_factored) return;
+
+    const int n = size();
+    work.resize(n);
+    double* x = work.data();
+    for (int i = 0; i < n; ++i)
+    {
+        x[i] = b[_order[i]];
+    }
+
+    // L y = b
+    for (int i = 0; i < n; ++i)
+    {
+        const double* row = &_values[_row_start[i]];
+        const int first = _first[i];
+        double sum = x[i];
+        for (int k = first; k < i; ++k)
+        {
+            sum -= row[k - first] * x[k];
+        }
+        x[i] = sum / row[i - first];
+    }
+
+    // L^T x = y, column oriented so rows are still read contiguously
+    for (int i = n - 1; i >= 0; --i)
+    {
+        const double* row = &_values[_row_start[i]];
+        const int first = _first[i];
+        x[i] /= row[i - first];
+        for (int k = first; k < i; ++k)
+        {
+            x[k] -= row[k - first] * x[i];
+        }
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        b[_order[i]] = x[i];
+    }
+}
+
+
+static int bfs_last_level(int start, const int* offsets, const int* neighbours,
+    std::vector<int>& level, int stamp, int& depth)
+{
+    // level marks the vertices reached by this sweep, so it never needs clearing
+    std::vector<int> queue(1, start);
+    std::vector<int> distance(1, 0);
+    level[start] = stamp;
+    int last = start;
+    int last_degree = offsets[start + 1] - offsets[start];
+    depth = 0;
+
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        const int v = queue[head];
+        const int d = distance[head];
+
+        // smallest degree vertex of the deepest level
+        const int degree = offsets[v + 1] - offsets[v];
+        if (d > depth || (d == depth && degree < last_degree))
+        {
+            depth = d;
+            last = v;
+            last_degree = degree;
+        }
+
+        for (int k = offsets[v]; k < offsets[v + 1]; ++k)
+        {
+            const int n = neighbours[k];
+            if (level[n] == stamp) continue;
+            level[n] = stamp;
+            queue.push_back(n);
+            distance.push_back(d + 1);
+        }
+    }
+
+    return last;
+}
@@ -0,0 +1,50 @@
+#ifndef ENVELOPE_CHOLESKY_H
+#define ENVELOPE_CHOLESKY_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+Cholesky factorization of a sparse symmetric positive definite matrix
+whose pattern is a CSR adjacency (MeshAdjacency layout) plus the diagonal.
+Rows are reordered with reverse Cuthill-McKee so the fill stays inside a
+narrow envelope, and L is stored row by row from the first nonzero column
+of each row to the diagonal. analyze() only depends on the pattern and
+can be kept while the values change, factor() then reuses its layout.
+*/
+class EnvelopeCholesky
+{
+public:
+    EnvelopeCholesky() {}
+
+    // ordering and envelope of the n x n pattern
+    void analyze(int n, const int* offsets, const int* neighbours);
+
+    // diagonal has n values, off_diagonal one per neighbours entry, false if not positive definite
+    bool factor(const double* diagonal, const double* off_diagonal);
+
+    void clear();
+
+    bool analyzed() const { return !_first.empty(); }
+    bool factored() const { return _factored; }
+    int size() const { return (int)_first.size(); }
+    size_t envelopeSize() const { return _values.size(); }
+
+    // solves A x = b in place, in the original ordering. work holds the permuted
+    // vector, one per thread so several solves can run at once
+    void solve(double* b, std::vector<double>& work) const;
+
+private:
+    std::vector<int> _order;        // permuted row -> original row
+    std::vector<int> _rank;         // original row -> permuted row
+    std::vector<int> _first;        // first stored column of each permuted row
+    std::vector<size_t> _row_start; // offset of each permuted row in _values, n + 1
+    std::vector<double> _values;    // rows of L, the diagonal is the last entry of each row
+
+    // pattern kept to scatter new values
+    std::vector<int> _offsets;
+    std::vector<int> _neighbours;
+    bool _factored=false;
+};
+
+#endif // !ENVELOPE_CHOLESKY_H
@@ -0,0 +1,247 @@
+#include "heatGeodesic.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// the poisson system is singular, shifted by this many heat time steps of mass
+#define HEAT_POISSON_SHIFT 1e-6
+
+static int edge_index(const MeshAdjacency& adjacency, int from, int to);
+
+void HeatGeodesic::clear()
+{
+    _adjacency.clear();
+    _triangles.clear();
+    _points.clear();
+    _cotangents.clear();
+    _masses.clear();
+    _heat.clear();
+    _poisson.clear();
+}
+
+void HeatGeodesic::build(int num_verts, const int* triangle_vertices, int num_triangles)
+{
+    clear();
+    if (num_verts <= 0 || num_triangles <= 0) return;
+
+    _triangles.assign(triangle_vertices, triangle_vertices + 3 * num_triangles);
+
+    // triangulation edges, diagonals included, every triangle is a three sided polygon
+    std::vector<int> triangle_counts(num_triangles, 3);
+    _adjacency.build(num_verts, triangle_counts.data(), num_triangles, triangle_vertices);
+
+    _heat.analyze(num_verts, _adjacency.offsets().data(), _adjacency.neighbours().data());
+    _poisson = _heat;
+}
+
+bool HeatGeodesic::factor(const float* points)
+{
+    const int num_verts = _adjacency.numVertices();
+    const int num_triangles = (int)_triangles.size() / 3;
+    if (!num_verts) return false;
+
+    _points.assign(points, points + 3 * num_verts);
+    _cotangents.assign(3 * num_triangles, 0.0);
+    _masses.assign(num_verts, 0.0);
+
+    // cotangent weight of every edge, half the cotangents of the two opposite corners
+    std::vector<double> weights(_adjacency.neighbours().size(), 0.0);
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* ids = &_triangles[3 * tri];
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            const int i = ids[c];
+            const int j = ids[(c + 1) % 3];
+            const int k = ids[(c + 2) % 3];
+            const double* pi = &_points[3 * i];
+            const double* pj = &_points[3 * j];
+            const double* pk = &_points[3 * k];
+
+            const double a[3] = { pj[0] - pi[0], pj[1] - pi[1], pj[2] - pi[2] };
+            const double b[3] = { pk[0] - pi[0], pk[1] - pi[1], pk[2] - pi[2] };
+            const double cross[3] = {
+                a[1] * b[2] - a[2] * b[1],
+                a[2] * b[0] - a[0] * b[2],
+                a[0] * b[1] - a[1] * b[0] };
+            const double double_area = sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+            if (double_area == 0.0) continue;
+
+            // corner c is opposite the edge (j, k)
+            const double cotangent = (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) / double_area;
+            _cotangents[3 * tri + c] = cotangent;
+            weights[edge_index(_adjacency, j, k)] += 0.5 * cotangent;
+            weights[edge_index(_adjacency, k, j)] += 0.5 * cotangent;
+
+            // each corner visit adds a third of the area to its own vertex
+            _masses[i] += double_area / 6.0;
+        }
+    }
+
+    // time step is the squared mean edge length
+    double edge_length = 0.0;
+    const std::vector<int>& offsets = _adjacency.offsets();
+    const std::vector<int>& neighbours = _adjacency.neighbours();
+    for (int v = 0; v < num_verts; ++v)
+    {
+        for (int k = offsets[v]; k < offsets[v + 1]; ++k)
+        {
+            const double* p = &_points[3 * v];
+            const double* q = &_points[3 * neighbours[k]];
+            edge_length += sqrt((q[0] - p[0]) * (q[0] - p[0]) +
+                (q[1] - p[1]) * (q[1] - p[1]) + (q[2] - p[2]) * (q[2] - p[2]));
+        }
+    }
+    edge_length = neighbours.empty() ? 1.0 : edge_length / neighbours.size();
+    const double time_step = edge_length > 0.0 ? edge_length * edge_length : 1.0;
+    const double shift = HEAT_POISSON_SHIFT / time_step;
+
+    std::vector<double> heat_diagonal(num_verts), heat_off(weights.size());
+    std::vector<double> poisson_diagonal(num_verts), poisson_off(weights.size());
+    for (int v = 0; v < num_verts; ++v)
+    {
+        double laplacian = 0.0;
+        for (int k = offsets[v]; k < offsets[v + 1]; ++k)
+        {
+            laplacian += weights[k];
+            heat_off[k] = -time_step * weights[k];
+            poisson_off[k] = -weights[k];
+        }
+        heat_diagonal[v] = _masses[v] + time_step * laplacian;
+        poisson_diagonal[v] = laplacian + shift * _masses[v];
+
+        // vertices without area are decoupled, keep their rows solvable
+        if (!(heat_diagonal[v] > 0.0)) heat_diagonal[v] = 1.0;
+        if (!(poisson_diagonal[v] > 0.0)) poisson_diagonal[v] = 1.0;
+    }
+
+    return _heat.factor(heat_diagonal.data(), heat_off.data()) &&
+        _poisson.factor(poisson_diagonal.data(), poisson_off.data());
+}
+
+void HeatGeodesic::distance(const int* source_vertices, const float* source_weights, int num_sources,
+    std::vector<float>& distances, Scratch& scratch) const
+{
+    const int num_verts = _adjacency.numVertices();
+    const int num_triangles = (int)_triangles.size() / 3;
+    distances.assign(num_verts, FLT_MAX);
+    if (!factored() || num_sources <= 0) return;
+
+    // heat only spreads inside the components of the sources
+    std::vector<char>& reached = scratch.reached;
+    std::vector<int>& front = scratch.front;
+    reached.assign(num_verts, 0);
+    front.clear();
+    for (int s = 0; s < num_sources; ++s)
+    {
+        if (reached[source_vertices[s]]) continue;
+        reached[source_vertices[s]] = 1;
+        front.push_back(source_vertices[s]);
+    }
+    for (size_t head = 0; head < front.size(); ++head)
+    {
+        for (const int* n = _adjacency.begin(front[head]); n != _adjacency.end(front[head]); ++n)
+        {
+            if (reached[*n]) continue;
+            reached[*n] = 1;
+            front.push_back(*n);
+        }
+    }
+
+    // 1. diffuse heat for one time step
+    std::vector<double>& heat = scratch.heat;
+    heat.assign(num_verts, 0.0);
+    for (int s = 0; s < num_sources; ++s)
+    {
+        heat[source_vertices[s]] += source_weights[s];
+    }
+    _heat.solve(heat.data(), scratch.solve);
+
+    // 2. unit field against the heat gradient of every triangle, 3. its divergence per vertex
+    std::vector<double>& divergence = scratch.divergence;
+    divergence.assign(num_verts, 0.0);
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* ids = &_triangles[3 * tri];
+        const double* p0 = &_points[3 * ids[0]];
+        const double* p1 = &_points[3 * ids[1]];
+        const double* p2 = &_points[3 * ids[2]];
+
+        const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        double normal[3] = {
+            e1[1] * e2[2] - e1[2] * e2[1],
+            e1[2] * e2[0] - e1[0] * e2[2],
+            e1[0] * e2[1] - e1[1] * e2[0] };
+        const double double_area = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (double_area == 0.0) continue;
+        normal[0] /= double_area;
+        normal[1] /= double_area;
+        normal[2] /= double_area;
+
+        // sum of heat times normal x opposite edge, the 1 / 2A factor drops out when normalized
+        double gradient[3] = { 0.0, 0.0, 0.0 };
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            const double* from = &_points[3 * ids[(c + 1) % 3]];
+            const double* to = &_points[3 * ids[(c + 2) % 3]];
+            const double edge[3] = { to[0] - from[0], to[1] - from[1], to[2] - from[2] };
+            const double u = heat[ids[c]];
+            gradient[0] += u * (normal[1] * edge[2] - normal[2] * edge[1]);
+            gradient[1] += u * (normal[2] * edge[0] - normal[0] * edge[2]);
+            gradient[2] += u * (normal[0] * edge[1] - normal[1] * edge[0]);
+        }
+
+        const double length = sqrt(gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2]);
+        if (length == 0.0) continue;
+        const double field[3] = { -gradient[0] / length, -gradient[1] / length, -gradient[2] / length };
+
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            const int i = ids[c];
+            const int j = ids[(c + 1) % 3];
+            const int k = ids[(c + 2) % 3];
+            const double* pi = &_points[3 * i];
+            const double* pj = &_points[3 * j];
+            const double* pk = &_points[3 * k];
+
+            // cotangents at k and j are opposite the edges (i, j) and (i, k)
+            const double cot_j = _cotangents[3 * tri + (c + 1) % 3];
+            const double cot_k = _cotangents[3 * tri + (c + 2) % 3];
+            const double dot_ij = (pj[0] - pi[0]) * field[0] + (pj[1] - pi[1]) * field[1] + (pj[2] - pi[2]) * field[2];
+            const double dot_ik = (pk[0] - pi[0]) * field[0] + (pk[1] - pi[1]) * field[1] + (pk[2] - pi[2]) * field[2];
+            divergence[i] += 0.5 * (cot_k * dot_ij + cot_j * dot_ik);
+        }
+    }
+
+    // 4. distance whose laplacian matches the divergence, L is positive so the sign flips
+    for (int v = 0; v < num_verts; ++v)
+    {
+        divergence[v] = -divergence[v];
+    }
+    _poisson.solve(divergence.data(), scratch.solve);
+
+    // the solution is known up to a constant, the sources sit at zero
+    double source_value = 0.0;
+    double source_total = 0.0;
+    for (int s = 0; s < num_sources; ++s)
+    {
+        source_value += source_weights[s] * divergence[source_vertices[s]];
+        source_total += source_weights[s];
+    }
+    if (source_total > 0.0) source_value /= source_total;
+
+    for (int v = 0; v < num_verts; ++v)
+    {
+        if (reached[v]) distances[v] = (float)std::max(0.0, divergence[v] - source_value);
+    }
+}
+
+
+static int edge_index(const MeshAdjacency& adjacency, int from, int to)
+{
+    // neighbours are sorted per vertex
+    const int* first = adjacency.begin(from);
+    return (int)(std::lower_bound(first, adjacency.end(from), to) - adjacency.neighbours().data());
+}
@@ -0,0 +1,64 @@
+#ifndef HEAT_GEODESIC_H
+#define HEAT_GEODESIC_H
+
+#include <vector>
+
+#include "meshAdjacency.h"
+#include "envelopeCholesky.h"
+
+/*
+Geodesic distance over a triangle mesh with the heat method (Crane et al.):
+heat diffused from the source for one short time step gives the direction
+of the distance gradient, a Poisson solve then recovers the distance.
+Both systems use the cotangent Laplacian and the lumped mass matrix on the
+edge adjacency of the triangulation. build() analyzes their pattern once
+per topology, factor() recomputes the values and factorizations when the
+points move, so each distance() is two back substitutions. distance() only
+reads the factorizations, any number of threads can call it at once with
+their own Scratch.
+*/
+class HeatGeodesic
+{
+public:
+    // buffers of one distance() call, kept by the caller so repeated calls do not allocate
+    struct Scratch
+    {
+        std::vector<char> reached;
+        std::vector<int> front;
+        std::vector<double> heat;
+        std::vector<double> divergence;
+        std::vector<double> solve;  // permuted vector of the back substitutions
+        std::vector<float> distances;  // not used by distance(), room for its output
+    };
+
+    HeatGeodesic() {}
+
+    // adjacency and envelope of the triangle table, copies the table
+    void build(int num_verts, const int* triangle_vertices, int num_triangles);
+
+    // cotangent weights, masses and both factorizations for these points
+    bool factor(const float* points);
+
+    void clear();
+
+    bool empty() const { return _heat.size() == 0; }
+    bool factored() const { return _heat.factored() && _poisson.factored(); }
+
+    // distance to the heat sources, vertices the heat never reaches get FLT_MAX
+    void distance(const int* source_vertices, const float* source_weights, int num_sources,
+        std::vector<float>& distances, Scratch& scratch) const;
+
+private:
+    MeshAdjacency _adjacency;
+    std::vector<int> _triangles;
+
+    // per factor() state
+    std::vector<double> _points;
+    std::vector<double> _cotangents;  // three per triangle, at each corner
+    std::vector<double> _masses;      // lumped, a third of the area of every adjacent triangle
+
+    EnvelopeCholesky _heat;     // M + t L
+    EnvelopeCholesky _poisson;  // L + e M
+};
+
+#endif // !HEAT_GEODESIC_H
@@ -0,0 +1,68 @@
+#include "meshAdjacency.h"
+
+#include <algorithm>
+
+void MeshAdjacency::clear()
+{
+    _offsets.clear();
+    _neighbours.clear();
+}
+
+void MeshAdjacency::build(int num_verts, const int* polygon_counts, int num_polygons,
+    const int* polygon_vertices)
+{
+    clear();
+    if (num_verts <= 0) return;
+
+    // every polygon edge is counted from both ends, shared edges twice
+    std::vector<int> degree(num_verts + 1, 0);
+    const int* polygon = polygon_vertices;
+    for (int f = 0; f < num_polygons; ++f)
+    {
+        const int count = polygon_counts[f];
+        for (int i = 0; i < count; ++i)
+        {
+            degree[polygon[i] + 1]++;
+            degree[polygon[(i + 1) % count] + 1]++;
+        }
+        polygon += count;
+    }
+
+    for (int v = 0; v < num_verts; ++v)
+    {
+        degree[v + 1] += degree[v];
+    }
+
+    std::vector<int> fill(degree.begin(), degree.end() - 1);
+    std::vector<int> edges(degree[num_verts]);
+    polygon = polygon_vertices;
+    for (int f = 0; f < num_polygons; ++f)
+    {
+        const int count = polygon_counts[f];
+        for (int i = 0; i < count; ++i)
+        {
+            const int a = polygon[i];
+            const int b = polygon[(i + 1) % count];
+            edges[fill[a]++] = b;
+            edges[fill[b]++] = a;
+        }
+        polygon += count;
+    }
+
+    // drop the duplicates of shared edges while compacting
+    _offsets.resize(num_verts + 1);
+    _neighbours.reserve(edges.size() / 2 + num_verts);
+    _offsets[0] = 0;
+    for (int v = 0; v < num_verts; ++v)
+    {
+        int* first = edges.data() + degree[v];
+        int* last = edges.data() + degree[v + 1];
+        std::sort(first, last);
+        last = std::unique(first, last);
+        for (int* n = first; n != last; ++n)
+        {
+            if (*n != v) _neighbours.push_back(*n);
+        }
+        _offsets[v + 1] = (int)_neighbours.size();
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef MESH_ADJACENCY_H
+#define MESH_ADJACENCY_H
+
+#include <vector>
+
+/*
+Vertex to vertex adjacency of a polygon mesh in compressed sparse row form.
+Neighbours of vertex v are neighbours()[offsets()[v]] up to offsets()[v + 1],
+built once from the polygon vertex lists (MFnMesh::getVertices layout).
+Only polygon edges connect vertices, triangulation diagonals are ignored.
+*/
+class MeshAdjacency
+{
+public:
+    MeshAdjacency() {}
+
+    void build(int num_verts, const int* polygon_counts, int num_polygons,
+        const int* polygon_vertices);
+    void clear();
+
+    bool empty() const { return _offsets.empty(); }
+    int numVertices() const { return _offsets.empty() ? 0 : (int)_offsets.size() - 1; }
+
+    const int* begin(int vertex) const { return _neighbours.data() + _offsets[vertex]; }
+    const int* end(int vertex) const { return _neighbours.data() + _offsets[vertex + 1]; }
+
+    const std::vector<int>& offsets() const { return _offsets; }
+    const std::vector<int>& neighbours() const { return _neighbours; }
+
+private:
+    std::vector<int> _offsets;     // num_verts + 1
+    std::vector<int> _neighbours;  // sorted, unique per vertex
+};
+
+#endif // !MESH_ADJACENCY_H
@@ -0,0 +1,37 @@
+#ifndef NODE_UTILS_H
+#define NODE_UTILS_H
+
+#include <maya/MIntArray.h>
+
+/*
+Pieces shared by the nodes of the plugin: the attribute flag macros and the
+topology hash their caches are keyed on. The hash is also stored in baked
+weight caches, changing it invalidates every bake.
+*/
+
+#define MAKE_INPUT(attr)                    \
+    CHECK_MSTATUS(attr.setKeyable(true));   \
+    CHECK_MSTATUS(attr.setStorable(true));  \
+    CHECK_MSTATUS(attr.setReadable(true));  \
+    CHECK_MSTATUS(attr.setWritable(true));
+
+#define MAKE_OUTPUT(attr)                   \
+    CHECK_MSTATUS(attr.setKeyable(false));  \
+    CHECK_MSTATUS(attr.setStorable(false)); \
+    CHECK_MSTATUS(attr.setReadable(true));  \
+    CHECK_MSTATUS(attr.setWritable(false));
+
+inline unsigned long long topology_hash(unsigned int num_verts, const MIntArray& triangle_vertices)
+{
+    // FNV-1a over the vertex count and the triangle table
+    unsigned long long hash = 14695981039346656037ULL;
+    hash = (hash ^ num_verts) * 1099511628211ULL;
+    for (unsigned int i = 0; i < triangle_vertices.length(); ++i)
+    {
+        hash = (hash ^ (unsigned int)triangle_vertices[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+#endif // !NODE_UTILS_H
@@ -1,5 +1,8 @@
 #include <maya\MFnPlugin.h>
 #include "vertexNode.h"
+#include "vertexNodeBake.h"
+#include "vertexDeformer.h"
+#include "../common/parallelFor.h"
 
 MStatus initializePlugin(MObject obj)
 {
@@ -15,6 +18,26 @@ MStatus initializePlugin(MObject obj)
         status.perror("registerNode");
         return status;
     }
+
+    status = fn_plugin.registerNode(VertexDeformer::name,
+        VertexDeformer::id,
+        &VertexDeformer::creator,
+        &VertexDeformer::initialize,
+        MPxNode::kDeformerNode);
+    if (!status)
+    {
+        status.perror("registerNode");
+        return status;
+    }
+
+    status = fn_plugin.registerCommand(VertexNodeBake::name,
+        &VertexNodeBake::creator,
+        &VertexNodeBake::newSyntax);
+    if (!status)
+    {
+        status.perror("registerCommand");
+        return status;
+    }
     return status;
 }
 
@@ -23,6 +46,20 @@ MStatus uninitializePlugin(MObject obj)
     MStatus status;
     MFnPlugin fn_plugin(obj);
 
+    status = fn_plugin.deregisterCommand(VertexNodeBake::name);
+    if (!status)
+    {
+        status.perror("deregisterCommand");
+        return status;
+    }
+
+    status = fn_plugin.deregisterNode(VertexDeformer::id);
+    if (!status)
+    {
+        status.perror("deregisterNode");
+        return status;
+    }
+
     fn_plugin.deregisterNode(VertexNode::id);
     if (!status)
     {
@@ -30,6 +67,9 @@ MStatus uninitializePlugin(MObject obj)
         return status;
     }
 
+    // no node is left to run chunks, join the workers before the plugin unloads
+    parallel_for_shutdown();
+
     return status;
 
 
@@ -0,0 +1,188 @@
+// Times the ray/triangle packet kernels outside of Maya on a synthetic mesh, a
+// bumpy sphere. Every ray is swept over all the packets of the mesh with the
+// scalar, SSE4.2 and AVX2 kernels, closest hit and hit mask, and the kernels
+// must agree on every hit. The BVH is then timed with the kernel selected at
+// load, VERTEX_NODE_ISA=scalar|sse4.2 forces a narrower one, which also
+// leaves the wider kernels out of the sweep. Exits 1 on a mismatch.
+//
+//   g++ -O2 -std=c++11 rayBench.cpp rayTriangle.cpp triangleBVH.cpp -o ray_bench
+//   ./ray_bench [segments] [rays]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "rayTriangle.h"
+#include "syntheticMesh.h"
+#include "triangleBVH.h"
+
+struct Kernel
+{
+    const char* isa;
+    IntersectPacketFunction closest;
+    IntersectPacketMaskFunction mask;
+};
+
+// closest hit of one ray and the hit lanes of every packet it crosses
+struct SweepResult
+{
+    int triangle;
+    float t, u, v;
+    std::vector<int> masks;
+    std::vector<float> mask_t;
+};
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// kernels up to the one picked at load, so VERTEX_NODE_ISA narrows the list too
+static std::vector<Kernel> available_kernels()
+{
+    std::vector<Kernel> kernels;
+    const char* isa = intersect_packet_isa();
+    kernels.push_back({ "scalar", intersect_packet_scalar, intersect_packet_mask_scalar });
+    if (strcmp(isa, "scalar") == 0) return kernels;
+    kernels.push_back({ "sse4.2", intersect_packet_sse42, intersect_packet_mask_sse42 });
+    if (strcmp(isa, "sse4.2") == 0) return kernels;
+    kernels.push_back({ "avx2", intersect_packet_avx2, intersect_packet_mask_avx2 });
+    return kernels;
+}
+
+static void sweep(const Kernel& kernel, const std::vector<TrianglePacket>& packets,
+    const float* origin, const float* direction, SweepResult& result)
+{
+    result.triangle = -1;
+    result.t = 1e30f;
+    result.u = result.v = 0.f;
+    for (size_t p = 0; p < packets.size(); ++p)
+    {
+        float t, u, v;
+        const int lane = kernel.closest(packets[p], origin, direction, result.t, t, u, v);
+        if (lane < 0) continue;
+        result.triangle = packets[p].triangle[lane];
+        result.t = t;
+        result.u = u;
+        result.v = v;
+    }
+
+    // every hit lane, t of the lanes that are not hit is left out of the comparison
+    result.masks.assign(packets.size(), 0);
+    result.mask_t.assign(packets.size() * RAY_PACKET_WIDTH, 0.f);
+    for (size_t p = 0; p < packets.size(); ++p)
+    {
+        float t[RAY_PACKET_WIDTH], u[RAY_PACKET_WIDTH], v[RAY_PACKET_WIDTH];
+        const int mask = kernel.mask(packets[p], origin, direction, 1e30f, t, u, v);
+        result.masks[p] = mask;
+        for (int lane = 0; lane < RAY_PACKET_WIDTH; ++lane)
+        {
+            if (mask & (1 << lane)) result.mask_t[p * RAY_PACKET_WIDTH + lane] = t[lane];
+        }
+    }
+}
+
+static bool same_hits(const SweepResult& a, const SweepResult& b)
+{
+    return a.triangle == b.triangle && a.t == b.t && a.u == b.u && a.v == b.v &&
+        a.masks == b.masks && a.mask_t == b.mask_t;
+}
+
+int main(int argc, char** argv)
+{
+    const int segments = argc > 1 ? atoi(argv[1]) : 64;
+    const int num_rays = argc > 2 ? atoi(argv[2]) : 200000;
+    if (segments < 3 || num_rays < 1) return 1;
+
+    SyntheticMesh mesh;
+    build_sphere(segments, mesh);
+    const int num_triangles = (int)mesh.triangle_vertices.size() / 3;
+    std::vector<float> rays;
+    build_rays(num_rays, rays);
+
+    // the mesh in packets of consecutive triangles, a flat sweep without the bvh
+    std::vector<TrianglePacket> packets((num_triangles + RAY_PACKET_WIDTH - 1) / RAY_PACKET_WIDTH);
+    std::vector<int> triangles(num_triangles);
+    for (int i = 0; i < num_triangles; ++i)
+    {
+        triangles[i] = i;
+    }
+    for (size_t p = 0; p < packets.size(); ++p)
+    {
+        const int first = (int)p * RAY_PACKET_WIDTH;
+        fill_triangle_packet(packets[p], &triangles[first],
+            std::min(RAY_PACKET_WIDTH, num_triangles - first),
+            mesh.triangle_vertices.data(), mesh.points.data());
+    }
+
+    printf("mesh %d triangles, %d rays, kernel at load %s\n", num_triangles, num_rays,
+        intersect_packet_isa());
+
+    // the sweep tests every triangle, a slice of the rays is enough to time and compare it
+    const int num_sweep_rays = std::max(1, std::min(num_rays, 2000000 / std::max(1, num_triangles)));
+    const std::vector<Kernel> kernels = available_kernels();
+    std::vector<std::vector<SweepResult>> results(kernels.size(),
+        std::vector<SweepResult>(num_sweep_rays));
+    bool ok = true;
+
+    for (size_t k = 0; k < kernels.size(); ++k)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < num_sweep_rays; ++r)
+        {
+            const float* ray = &rays[6 * (size_t)r];
+            sweep(kernels[k], packets, ray, ray + 3, results[k][r]);
+        }
+        const double ms = milliseconds_since(start);
+
+        int mismatches = 0;
+        for (int r = 0; r < num_sweep_rays; ++r)
+        {
+            if (!same_hits(results[0][r], results[k][r])) ++mismatches;
+        }
+        ok = ok && mismatches == 0;
+
+        // a ray is the closest hit and the mask over the whole mesh
+        printf("sweep %-7s %12.0f rays/s, %s\n", kernels[k].isa, num_sweep_rays / (ms * 1e-3),
+            mismatches ? "DIFFERS from scalar" : "same hits as scalar");
+        if (mismatches) printf("  %d of %d rays differ\n", mismatches, num_sweep_rays);
+    }
+
+    TriangleBVH bvh;
+    auto start = std::chrono::steady_clock::now();
+    bvh.build(mesh.points.data(), mesh.triangle_vertices.data(), num_triangles);
+    const double build_ms = milliseconds_since(start);
+
+    std::vector<RayHit> hits(num_rays);
+    std::vector<char> hit(num_rays);
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < num_rays; ++r)
+    {
+        const float* ray = &rays[6 * (size_t)r];
+        hit[r] = bvh.intersect(ray, ray + 3, 1e30f, hits[r]);
+    }
+    const double bvh_ms = milliseconds_since(start);
+
+    int num_hits = 0;
+    int mismatches = 0;
+    for (int r = 0; r < num_rays; ++r)
+    {
+        num_hits += hit[r];
+        if (r >= num_sweep_rays) continue;
+
+        // the bvh holds other packets, a tie between two triangles may resolve either way
+        const SweepResult& expected = results[0][r];
+        if (hit[r] != (expected.triangle >= 0) || (hit[r] && hits[r].t != expected.t)) ++mismatches;
+    }
+    ok = ok && mismatches == 0;
+
+    printf("bvh   %-7s %12.0f rays/s, build %.2f ms, %d hits, %s\n", intersect_packet_isa(),
+        num_rays / (bvh_ms * 1e-3), build_ms, num_hits,
+        mismatches ? "DIFFERS from the sweep" : "same hits as the sweep");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,401 @@
+#include "rayTriangle.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RAY_TRIANGLE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#define TARGET_SSE42
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#else
+#define RAY_TRIANGLE_X86 0
+#endif
+
+// determinant below this is a ray parallel to the triangle
+#define RAY_TRIANGLE_EPSILON 1e-9f
+
+static IntersectPacketFunction select_kernel(const char** isa,
+    IntersectPacketMaskFunction* mask_kernel);
+
+static const char* g_isa = "scalar";
+static IntersectPacketMaskFunction g_intersect_packet_mask = intersect_packet_mask_scalar;
+static const IntersectPacketFunction g_intersect_packet = select_kernel(&g_isa,
+    &g_intersect_packet_mask);
+
+void fill_triangle_packet(TrianglePacket& packet, const int* triangles, int count,
+    const int* triangle_vertices, const float* points)
+{
+    memset(&packet, 0, sizeof(TrianglePacket));
+    packet.count = count;
+
+    for (int lane = 0; lane < count; ++lane)
+    {
+        const int* ids = triangle_vertices + 3 * triangles[lane];
+        const float* p0 = points + 3 * ids[0];
+        const float* p1 = points + 3 * ids[1];
+        const float* p2 = points + 3 * ids[2];
+
+        packet.triangle[lane] = triangles[lane];
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+            packet.v0[k][lane] = p0[k];
+            packet.e1[k][lane] = p1[k] - p0[k];
+            packet.e2[k][lane] = p2[k] - p0[k];
+        }
+    }
+
+    // padding lanes keep zero edges, so their determinant is 0 and they never hit
+    for (int lane = count; lane < RAY_PACKET_WIDTH; ++lane)
+    {
+        packet.triangle[lane] = -1;
+    }
+}
+
+int intersect_packet(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v)
+{
+    return g_intersect_packet(packet, origin, direction, max_t, t, u, v);
+}
+
+int intersect_packet_mask(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v)
+{
+    return g_intersect_packet_mask(packet, origin, direction, max_t, t, u, v);
+}
+
+const char* intersect_packet_isa()
+{
+    return g_isa;
+}
+
+static int closest_lane(int mask, const float* lane_t, const float* lane_u, const float* lane_v,
+    float& t, float& u, float& v)
+{
+    // closest lane wins, the first one on ties
+    int hit_lane = -1;
+    for (int lane = 0; mask; ++lane, mask >>= 1)
+    {
+        if (!(mask & 1)) continue;
+        if (hit_lane < 0 || lane_t[lane] < t)
+        {
+            hit_lane = lane;
+            t = lane_t[lane];
+            u = lane_u[lane];
+            v = lane_v[lane];
+        }
+    }
+
+    return hit_lane;
+}
+
+int intersect_packet_mask_scalar(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* lane_t, float* lane_u, float* lane_v)
+{
+    int mask = 0;
+
+    for (int lane = 0; lane < packet.count; ++lane)
+    {
+        const float e1[3] = { packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane] };
+        const float e2[3] = { packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane] };
+
+        float pvec[3] = {
+            direction[1] * e2[2] - direction[2] * e2[1],
+            direction[2] * e2[0] - direction[0] * e2[2],
+            direction[0] * e2[1] - direction[1] * e2[0] };
+
+        float det = e1[0] * pvec[0] + e1[1] * pvec[1] + e1[2] * pvec[2];
+        if (!(std::fabs(det) >= RAY_TRIANGLE_EPSILON)) continue;
+        float inv_det = 1.f / det;
+
+        float tvec[3] = {
+            origin[0] - packet.v0[0][lane],
+            origin[1] - packet.v0[1][lane],
+            origin[2] - packet.v0[2][lane] };
+
+        float u = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * inv_det;
+        if (!(u >= 0.f && u <= 1.f)) continue;
+
+        float qvec[3] = {
+            tvec[1] * e1[2] - tvec[2] * e1[1],
+            tvec[2] * e1[0] - tvec[0] * e1[2],
+            tvec[0] * e1[1] - tvec[1] * e1[0] };
+
+        float v = (direction[0] * qvec[0] + direction[1] * qvec[1] + direction[2] * qvec[2]) * inv_det;
+        if (!(v >= 0.f && u + v <= 1.f)) continue;
+
+        float t = (e2[0] * qvec[0] + e2[1] * qvec[1] + e2[2] * qvec[2]) * inv_det;
+        if (!(t >= 0.f && t <= max_t)) continue;
+
+        lane_t[lane] = t;
+        lane_u[lane] = u;
+        lane_v[lane] = v;
+        mask |= 1 << lane;
+    }
+
+    return mask;
+}
+
+int intersect_packet_scalar(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v)
+{
+    float lane_t[RAY_PACKET_WIDTH];
+    float lane_u[RAY_PACKET_WIDTH];
+    float lane_v[RAY_PACKET_WIDTH];
+
+    int mask = intersect_packet_mask_scalar(packet, origin, direction, max_t, lane_t, lane_u, lane_v);
+    return closest_lane(mask, lane_t, lane_u, lane_v, t, u, v);
+}
+
+#if RAY_TRIANGLE_X86
+
+// same operation order as the scalar kernel, no fma, so every lane matches it bit to bit
+TARGET_SSE42 static int intersect_half_sse42(const TrianglePacket& packet, int offset,
+    const float origin[3], const float direction[3], float max_t,
+    float* lane_t, float* lane_u, float* lane_v)
+{
+    const __m128 dx = _mm_set1_ps(direction[0]);
+    const __m128 dy = _mm_set1_ps(direction[1]);
+    const __m128 dz = _mm_set1_ps(direction[2]);
+
+    const __m128 e1x = _mm_loadu_ps(packet.e1[0] + offset);
+    const __m128 e1y = _mm_loadu_ps(packet.e1[1] + offset);
+    const __m128 e1z = _mm_loadu_ps(packet.e1[2] + offset);
+    const __m128 e2x = _mm_loadu_ps(packet.e2[0] + offset);
+    const __m128 e2y = _mm_loadu_ps(packet.e2[1] + offset);
+    const __m128 e2z = _mm_loadu_ps(packet.e2[2] + offset);
+
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+        _mm_mul_ps(e1z, pz));
+    const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+    __m128 mask = _mm_cmpge_ps(abs_det, _mm_set1_ps(RAY_TRIANGLE_EPSILON));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+    const __m128 tx = _mm_sub_ps(_mm_set1_ps(origin[0]), _mm_loadu_ps(packet.v0[0] + offset));
+    const __m128 ty = _mm_sub_ps(_mm_set1_ps(origin[1]), _mm_loadu_ps(packet.v0[1] + offset));
+    const __m128 tz = _mm_sub_ps(_mm_set1_ps(origin[2]), _mm_loadu_ps(packet.v0[2] + offset));
+
+    const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)),
+        _mm_mul_ps(tz, pz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(u, _mm_set1_ps(1.f)));
+
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+    const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+        _mm_mul_ps(dz, qz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+
+    const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+        _mm_mul_ps(e2z, qz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(t, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(t, _mm_set1_ps(max_t)));
+
+    _mm_storeu_ps(lane_t + offset, t);
+    _mm_storeu_ps(lane_u + offset, u);
+    _mm_storeu_ps(lane_v + offset, v);
+    return _mm_movemask_ps(mask);
+}
+
+TARGET_SSE42 int intersect_packet_mask_sse42(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* lane_t, float* lane_u, float* lane_v)
+{
+    int mask = intersect_half_sse42(packet, 0, origin, direction, max_t, lane_t, lane_u, lane_v);
+    if (packet.count > 4)
+    {
+        mask |= intersect_half_sse42(packet, 4, origin, direction, max_t,
+            lane_t, lane_u, lane_v) << 4;
+    }
+
+    return mask;
+}
+
+int intersect_packet_sse42(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v)
+{
+    float lane_t[RAY_PACKET_WIDTH];
+    float lane_u[RAY_PACKET_WIDTH];
+    float lane_v[RAY_PACKET_WIDTH];
+
+    int mask = intersect_packet_mask_sse42(packet, origin, direction, max_t, lane_t, lane_u, lane_v);
+    return closest_lane(mask, lane_t, lane_u, lane_v, t, u, v);
+}
+
+TARGET_AVX2 int intersect_packet_mask_avx2(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t_array, float* u_array, float* v_array)
+{
+    const __m256 dx = _mm256_set1_ps(direction[0]);
+    const __m256 dy = _mm256_set1_ps(direction[1]);
+    const __m256 dz = _mm256_set1_ps(direction[2]);
+
+    const __m256 e1x = _mm256_loadu_ps(packet.e1[0]);
+    const __m256 e1y = _mm256_loadu_ps(packet.e1[1]);
+    const __m256 e1z = _mm256_loadu_ps(packet.e1[2]);
+    const __m256 e2x = _mm256_loadu_ps(packet.e2[0]);
+    const __m256 e2y = _mm256_loadu_ps(packet.e2[1]);
+    const __m256 e2z = _mm256_loadu_ps(packet.e2[2]);
+
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)),
+        _mm256_mul_ps(e1z, pz));
+    const __m256 abs_det = _mm256_andnot_ps(_mm256_set1_ps(-0.f), det);
+    __m256 mask = _mm256_cmp_ps(abs_det, _mm256_set1_ps(RAY_TRIANGLE_EPSILON), _CMP_GE_OQ);
+    const __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+
+    const __m256 tx = _mm256_sub_ps(_mm256_set1_ps(origin[0]), _mm256_loadu_ps(packet.v0[0]));
+    const __m256 ty = _mm256_sub_ps(_mm256_set1_ps(origin[1]), _mm256_loadu_ps(packet.v0[1]));
+    const __m256 tz = _mm256_sub_ps(_mm256_set1_ps(origin[2]), _mm256_loadu_ps(packet.v0[2]));
+
+    const __m256 lane_u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px),
+        _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(lane_u, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(lane_u, _mm256_set1_ps(1.f), _CMP_LE_OQ));
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+    const __m256 lane_v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx),
+        _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(lane_v, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(lane_u, lane_v),
+        _mm256_set1_ps(1.f), _CMP_LE_OQ));
+
+    const __m256 lane_t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx),
+        _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(lane_t, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(lane_t, _mm256_set1_ps(max_t), _CMP_LE_OQ));
+
+    _mm256_storeu_ps(t_array, lane_t);
+    _mm256_storeu_ps(u_array, lane_u);
+    _mm256_storeu_ps(v_array, lane_v);
+    return _mm256_movemask_ps(mask);
+}
+
+int intersect_packet_avx2(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v)
+{
+    float lane_t[RAY_PACKET_WIDTH];
+    float lane_u[RAY_PACKET_WIDTH];
+    float lane_v[RAY_PACKET_WIDTH];
+
+    int mask = intersect_packet_mask_avx2(packet, origin, direction, max_t, lane_t, lane_u, lane_v);
+    return closest_lane(mask, lane_t, lane_u, lane_v, t, u, v);
+}
+
+#else
+
+// no simd kernels outside x86, keep the symbols so callers don't need to care
+int intersect_packet_sse42(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v)
+{
+    return intersect_packet_scalar(packet, origin, direction, max_t, t, u, v);
+}
+
+int intersect_packet_avx2(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v)
+{
+    return intersect_packet_scalar(packet, origin, direction, max_t, t, u, v);
+}
+
+int intersect_packet_mask_sse42(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v)
+{
+    return intersect_packet_mask_scalar(packet, origin, direction, max_t, t, u, v);
+}
+
+int intersect_packet_mask_avx2(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v)
+{
+    return intersect_packet_mask_scalar(packet, origin, direction, max_t, t, u, v);
+}
+
+#endif
+
+
+static IntersectPacketFunction select_kernel(const char** isa,
+    IntersectPacketMaskFunction* mask_kernel)
+{
+    bool has_avx2 = false;
+    bool has_sse42 = false;
+
+#if RAY_TRIANGLE_X86
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    has_sse42 = (info[2] & (1 << 20)) != 0;
+    const bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+        (_xgetbv(0) & 6) == 6;
+
+    if (max_leaf >= 7 && os_saves_ymm)
+    {
+        __cpuidex(info, 7, 0);
+        has_avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2") != 0;
+    has_sse42 = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+#endif
+
+    // VERTEX_NODE_ISA=scalar|sse4.2 forces a narrower kernel, to compare them on the farm
+    const char* forced = getenv("VERTEX_NODE_ISA");
+    if (forced && strcmp(forced, "scalar") == 0)
+    {
+        has_avx2 = has_sse42 = false;
+    }
+    else if (forced && strcmp(forced, "sse4.2") == 0)
+    {
+        has_avx2 = false;
+    }
+
+    if (has_avx2)
+    {
+        *isa = "avx2";
+        *mask_kernel = intersect_packet_mask_avx2;
+        return intersect_packet_avx2;
+    }
+    if (has_sse42)
+    {
+        *isa = "sse4.2";
+        *mask_kernel = intersect_packet_mask_sse42;
+        return intersect_packet_sse42;
+    }
+
+    *isa = "scalar";
+    *mask_kernel = intersect_packet_mask_scalar;
+    return intersect_packet_scalar;
+}
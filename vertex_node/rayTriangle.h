@@ -0,0 +1,68 @@
+#ifndef RAY_TRIANGLE_H
+#define RAY_TRIANGLE_H
+
+/*
+Ray against triangle packet intersection, Moller-Trumbore.
+A packet holds up to eight triangles in SoA layout so one ray is tested
+against all of them at once. The kernel is picked when the plugin loads:
+AVX2 (8 lanes), SSE4.2 (2x4 lanes) or scalar, all with the same results.
+*/
+
+#define RAY_PACKET_WIDTH 8
+
+struct TrianglePacket
+{
+    float v0[3][RAY_PACKET_WIDTH];
+    float e1[3][RAY_PACKET_WIDTH];  // v1 - v0
+    float e2[3][RAY_PACKET_WIDTH];  // v2 - v0
+    int triangle[RAY_PACKET_WIDTH];
+    int count;
+};
+
+// fill a packet with count triangles, unused lanes become degenerate and never hit
+void fill_triangle_packet(TrianglePacket& packet, const int* triangles, int count,
+    const int* triangle_vertices, const float* points);
+
+// closest hit lane with 0 <= t <= max_t, -1 when no triangle is hit
+typedef int (*IntersectPacketFunction)(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v);
+
+int intersect_packet(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v);
+
+// every hitting lane as a bitmask, t, u and v are written for the hitting lanes
+typedef int (*IntersectPacketMaskFunction)(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v);
+
+int intersect_packet_mask(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v);
+
+// kernels are public so they can be compared against each other
+int intersect_packet_scalar(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v);
+int intersect_packet_sse42(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v);
+int intersect_packet_avx2(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float& t, float& u, float& v);
+
+int intersect_packet_mask_scalar(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v);
+int intersect_packet_mask_sse42(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v);
+int intersect_packet_mask_avx2(const TrianglePacket& packet,
+    const float origin[3], const float direction[3], float max_t,
+    float* t, float* u, float* v);
+
+// name of the kernel selected at load time: "avx2", "sse4.2" or "scalar"
+const char* intersect_packet_isa();
+
+#endif // !RAY_TRIANGLE_H
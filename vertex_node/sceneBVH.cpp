@@ -0,0 +1,159 @@
+#include "sceneBVH.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <utility>
+
+#define SCENE_MAX_LEAF_SIZE 2
+#define SCENE_STACK_SIZE 64
+
+
+void SceneBVH::clear()
+{
+    _nodes.clear();
+    _indices.clear();
+    _meshes.clear();
+}
+
+void SceneBVH::build(const std::vector<const TriangleBVH*>& meshes)
+{
+    clear();
+    _meshes = meshes;
+
+    // empty meshes have no bounds and can never be hit
+    _centroids.assign(3 * meshes.size(), 0.f);
+    for (int i = 0; i < (int)meshes.size(); ++i)
+    {
+        if (!meshes[i] || meshes[i]->empty()) continue;
+
+        const TriangleBVH::Node& root = meshes[i]->root();
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+            _centroids[3 * i + k] = 0.5f * (root.bmin[k] + root.bmax[k]);
+        }
+        _indices.push_back(i);
+    }
+    if (_indices.empty()) return;
+
+    _nodes.reserve(2 * _indices.size());
+    _nodes.push_back(TriangleBVH::Node());
+    buildNode(0, 0, (int)_indices.size());
+}
+
+void SceneBVH::buildNode(int node_id, int first, int count)
+{
+    // bounds of the mesh roots
+    TriangleBVH::Node node;
+    node.bmin[0] = node.bmin[1] = node.bmin[2] = FLT_MAX;
+    node.bmax[0] = node.bmax[1] = node.bmax[2] = -FLT_MAX;
+    float cmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float cmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int i = first; i < first + count; ++i)
+    {
+        const TriangleBVH::Node& root = _meshes[_indices[i]]->root();
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+            node.bmin[k] = std::min(node.bmin[k], root.bmin[k]);
+            node.bmax[k] = std::max(node.bmax[k], root.bmax[k]);
+            cmin[k] = std::min(cmin[k], _centroids[3 * _indices[i] + k]);
+            cmax[k] = std::max(cmax[k], _centroids[3 * _indices[i] + k]);
+        }
+    }
+
+    if (count <= SCENE_MAX_LEAF_SIZE)
+    {
+        node.left_first = first;
+        node.count = count;
+        _nodes[node_id] = node;
+        return;
+    }
+
+    // a few dozen meshes, a median split on the widest centroid axis is enough
+    int axis = 0;
+    if (cmax[1] - cmin[1] > cmax[axis] - cmin[axis]) axis = 1;
+    if (cmax[2] - cmin[2] > cmax[axis] - cmin[axis]) axis = 2;
+
+    const int half = count / 2;
+    std::nth_element(_indices.begin() + first, _indices.begin() + first + half,
+        _indices.begin() + first + count, [&](int a, int b) {
+            return _centroids[3 * a + axis] < _centroids[3 * b + axis];
+        });
+
+    // children are stored next to each other, like the mesh trees
+    const int left = (int)_nodes.size();
+    _nodes.push_back(TriangleBVH::Node());
+    _nodes.push_back(TriangleBVH::Node());
+    node.left_first = left;
+    node.count = 0;
+    _nodes[node_id] = node;
+
+    buildNode(left, first, half);
+    buildNode(left + 1, first + half, count - half);
+}
+
+bool SceneBVH::intersect(const float origin[3], const float direction[3], float max_t,
+    int& mesh, RayHit& hit) const
+{
+    if (_nodes.empty()) return false;
+
+    float inv_direction[3];
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        inv_direction[k] = direction[k] != 0.f ? 1.f / direction[k] : FLT_MAX;
+    }
+
+    bool found = false;
+    float best_t = max_t;
+
+    int stack[SCENE_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size)
+    {
+        const TriangleBVH::Node& node = _nodes[stack[--stack_size]];
+
+        float t_near;
+        if (!intersect_box(node, origin, inv_direction, best_t, t_near)) continue;
+
+        if (node.count)
+        {
+            // the mesh tree only looks for hits closer than the best one so far
+            for (int i = node.left_first; i < node.left_first + node.count; ++i)
+            {
+                RayHit mesh_hit;
+                if (!_meshes[_indices[i]]->intersect(origin, direction, best_t, mesh_hit)) continue;
+
+                best_t = mesh_hit.t;
+                hit = mesh_hit;
+                mesh = _indices[i];
+                found = true;
+            }
+            continue;
+        }
+
+        // visit the nearest child first
+        int near_id = node.left_first;
+        int far_id = node.left_first + 1;
+        float t_left, t_right;
+        const bool hit_left = intersect_box(_nodes[near_id], origin, inv_direction, best_t, t_left);
+        const bool hit_right = intersect_box(_nodes[far_id], origin, inv_direction, best_t, t_right);
+
+        if (hit_left && hit_right)
+        {
+            if (t_right < t_left) std::swap(near_id, far_id);
+            stack[stack_size++] = far_id;
+            stack[stack_size++] = near_id;
+        }
+        else if (hit_left)
+        {
+            stack[stack_size++] = near_id;
+        }
+        else if (hit_right)
+        {
+            stack[stack_size++] = far_id;
+        }
+    }
+
+    return found;
+}
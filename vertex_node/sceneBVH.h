@@ -0,0 +1,40 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <vector>
+
+#include "triangleBVH.h"
+
+/*
+Top level of a two level hierarchy over several meshes. Every mesh keeps
+its own TriangleBVH, cached by its owner, and this tree only holds their
+root bounds, so rebuilding it each evaluation costs next to nothing.
+A ray walks the top tree and enters the mesh trees whose bounds it hits.
+*/
+
+class SceneBVH
+{
+public:
+    SceneBVH() {}
+
+    // the mesh trees are referenced, not copied, and must outlive the queries
+    void build(const std::vector<const TriangleBVH*>& meshes);
+    void clear();
+
+    bool empty() const { return _nodes.empty(); }
+
+    // closest hit over every mesh, mesh is the index in the build list
+    bool intersect(const float origin[3], const float direction[3], float max_t,
+        int& mesh, RayHit& hit) const;
+
+private:
+    // fills node_id from _indices[first, first + count), children are appended
+    void buildNode(int node_id, int first, int count);
+
+    std::vector<TriangleBVH::Node> _nodes;
+    std::vector<int> _indices;  // mesh ids, leaves point into it
+    std::vector<const TriangleBVH*> _meshes;
+    std::vector<float> _centroids;  // only used while building
+};
+
+#endif // !SCENE_BVH_H
@@ -0,0 +1,46 @@
+#include "spatialHashGrid.h"
+
+void SpatialHashGrid::clear()
+{
+    _cell_size = 0.f;
+    _inv_cell_size = 0.f;
+    _table_mask = 0;
+    _bucket_start.clear();
+    _entries.clear();
+}
+
+void SpatialHashGrid::build(const float* points, int num_points, float cell_size)
+{
+    clear();
+    if (num_points <= 0 || !(cell_size > 0.f)) return;
+
+    _cell_size = cell_size;
+    _inv_cell_size = 1.f / cell_size;
+
+    // power of two table with about one bucket per point
+    unsigned int table_size = 1;
+    while (table_size < (unsigned int)num_points) table_size <<= 1;
+    _table_mask = table_size - 1;
+
+    std::vector<unsigned int> point_buckets(num_points);
+    _bucket_start.assign(table_size + 1, 0);
+    for (int i = 0; i < num_points; ++i)
+    {
+        const float* p = points + 3 * i;
+        point_buckets[i] = bucket(cell(p[0]), cell(p[1]), cell(p[2]));
+        _bucket_start[point_buckets[i] + 1]++;
+    }
+
+    // counting sort, bucket b owns [_bucket_start[b], _bucket_start[b + 1])
+    for (unsigned int b = 0; b < table_size; ++b)
+    {
+        _bucket_start[b + 1] += _bucket_start[b];
+    }
+
+    std::vector<int> fill(_bucket_start.begin(), _bucket_start.end() - 1);
+    _entries.resize(num_points);
+    for (int i = 0; i < num_points; ++i)
+    {
+        _entries[fill[point_buckets[i]]++] = i;
+    }
+}
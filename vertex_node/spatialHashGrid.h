@@ -0,0 +1,96 @@
+#ifndef SPATIAL_HASH_GRID_H
+#define SPATIAL_HASH_GRID_H
+
+#include <cmath>
+#include <vector>
+
+/*
+Uniform grid over a point cloud, cells hashed into a fixed size table.
+Points are bucketed with a counting sort, so a build is O(points) and a
+radius query only touches the buckets of the cells the sphere overlaps.
+Like TriangleBVH it keeps point ids only, positions are passed to queries.
+*/
+class SpatialHashGrid
+{
+public:
+    SpatialHashGrid() {}
+
+    void build(const float* points, int num_points, float cell_size);
+    void clear();
+
+    bool empty() const { return _entries.empty(); }
+    float cellSize() const { return _cell_size; }
+
+    // buckets a query visited, owned by the caller so queries stay const and nothing is
+    // allocated per query. stamps avoid clearing them, one generation per query
+    struct QueryScratch
+    {
+        std::vector<unsigned int> stamp;
+        unsigned int generation=0;
+    };
+
+    // calls func(point_id, squared_distance) for every point closer than radius
+    template <typename Function>
+    void query(const float* points, const float center[3], float radius, QueryScratch& scratch,
+        const Function& func) const;
+
+private:
+    unsigned int bucket(int x, int y, int z) const
+    {
+        return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^
+            (unsigned int)z * 83492791u) & _table_mask;
+    }
+
+    int cell(float value) const { return (int)std::floor(value * _inv_cell_size); }
+
+    float _cell_size=0.f;
+    float _inv_cell_size=0.f;
+    unsigned int _table_mask=0;
+    std::vector<int> _bucket_start;  // table size + 1 offsets into _entries
+    std::vector<int> _entries;       // point ids sorted by bucket
+};
+
+template <typename Function>
+void SpatialHashGrid::query(const float* points, const float center[3], float radius,
+    QueryScratch& scratch, const Function& func) const
+{
+    if (_entries.empty()) return;
+
+    const float radius2 = radius * radius;
+    const int x0 = cell(center[0] - radius), x1 = cell(center[0] + radius);
+    const int y0 = cell(center[1] - radius), y1 = cell(center[1] + radius);
+    const int z0 = cell(center[2] - radius), z1 = cell(center[2] + radius);
+
+    // different cells may share a bucket, visit each bucket once
+    if (scratch.stamp.size() != _bucket_start.size() - 1 || ++scratch.generation == 0)
+    {
+        scratch.stamp.assign(_bucket_start.size() - 1, 0);
+        scratch.generation = 1;
+    }
+
+    for (int z = z0; z <= z1; ++z)
+    {
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = x0; x <= x1; ++x)
+            {
+                const unsigned int b = bucket(x, y, z);
+                if (scratch.stamp[b] == scratch.generation) continue;
+                scratch.stamp[b] = scratch.generation;
+
+                for (int i = _bucket_start[b]; i < _bucket_start[b + 1]; ++i)
+                {
+                    const int id = _entries[i];
+                    const float* p = points + 3 * id;
+                    const float dx = p[0] - center[0];
+                    const float dy = p[1] - center[1];
+                    const float dz = p[2] - center[2];
+                    const float distance2 = dx * dx + dy * dy + dz * dz;
+                    if (distance2 < radius2) func(id, distance2);
+                }
+            }
+        }
+    }
+}
+
+#endif // !SPATIAL_HASH_GRID_H
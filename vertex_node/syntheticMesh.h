@@ -0,0 +1,80 @@
+#ifndef SYNTHETIC_MESH_H
+#define SYNTHETIC_MESH_H
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+/*
+Meshes and rays built from a few parameters, so the standalone benches and
+tests of the BVH and the weight kernels run without Maya or scene files.
+Same arguments, same bits, the random rays come from a fixed seed.
+*/
+
+struct SyntheticMesh
+{
+    std::vector<float> points;
+    std::vector<int> triangle_vertices;
+};
+
+// uv sphere of radius about 1 with a few waves on it, 2 * segments * segments triangles
+inline void build_sphere(int segments, SyntheticMesh& mesh)
+{
+    const int rings = segments;
+    const int columns = 2 * segments;
+    const float pi = 3.14159265358979323846f;
+
+    for (int i = 0; i <= rings; ++i)
+    {
+        const float theta = pi * i / rings;
+        for (int j = 0; j < columns; ++j)
+        {
+            const float phi = 2.f * pi * j / columns;
+            const float radius = 1.f + 0.05f * std::sin(7.f * theta) * std::cos(5.f * phi);
+            mesh.points.push_back(radius * std::sin(theta) * std::cos(phi));
+            mesh.points.push_back(radius * std::cos(theta));
+            mesh.points.push_back(radius * std::sin(theta) * std::sin(phi));
+        }
+    }
+
+    for (int i = 0; i < rings; ++i)
+    {
+        for (int j = 0; j < columns; ++j)
+        {
+            const int a = i * columns + j;
+            const int b = i * columns + (j + 1) % columns;
+            const int c = a + columns;
+            const int d = b + columns;
+            const int quad[6] = { a, c, b, b, c, d };
+            mesh.triangle_vertices.insert(mesh.triangle_vertices.end(), quad, quad + 6);
+        }
+    }
+}
+
+// origins around the sphere aimed somewhere inside it, a few aimed past it
+inline void build_rays(int num_rays, std::vector<float>& rays)
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+    rays.resize(6 * (size_t)num_rays);
+
+    for (int r = 0; r < num_rays; ++r)
+    {
+        float* origin = &rays[6 * (size_t)r];
+        float* direction = origin + 3;
+        float length = 0.f;
+        for (int k = 0; k < 3; ++k)
+        {
+            origin[k] = 3.f * uniform(random);
+            direction[k] = 1.2f * uniform(random) - origin[k];
+            length += direction[k] * direction[k];
+        }
+        length = std::sqrt(length);
+        for (int k = 0; k < 3; ++k)
+        {
+            direction[k] /= length;
+        }
+    }
+}
+
+#endif // !SYNTHETIC_MESH_H
@@ -0,0 +1,181 @@
+// Runs the queries the node spreads across threads, get_vertex_weight and the
+// BVH intersect, intersectAll, occluded and closestPoint, plus the two level
+// SceneBVH, from many threads at once over the same trees, and compares every
+// result bit for bit against a serial run. Threads start at different rays so
+// they hit the same nodes and packets at different times. Exits 1 on a
+// mismatch.
+//
+//   g++ -O2 -std=c++11 -pthread threadStress.cpp rayTriangle.cpp triangleBVH.cpp sceneBVH.cpp -o thread_stress
+//   ./thread_stress [threads] [rays] [rounds]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "../common/parallelFor.h"
+#include "sceneBVH.h"
+#include "syntheticMesh.h"
+#include "triangleBVH.h"
+#include "vertexWeights.h"
+
+// max distance of the closest point queries, about a third of the sphere radius
+#define STRESS_QUERY_DISTANCE 0.3f
+
+// everything one ray or query point reads from the shared trees
+struct QueryResult
+{
+    RayHit hit;
+    VertexWeights weights;
+    int all_hits;
+    float all_t[4];  // first hits of intersectAll
+    int occluded;
+    PointHit point;
+    int scene_mesh;
+    RayHit scene_hit;
+};
+
+struct Scene
+{
+    SyntheticMesh mesh;
+    std::vector<float> moved;  // the mesh points shifted along x, the second scene mesh
+    TriangleBVH bvh;
+    TriangleBVH moved_bvh;
+    SceneBVH scene;
+    std::vector<float> rays;
+};
+
+static void query(const Scene& scene, int r, std::vector<RayHit>& all, QueryResult& result)
+{
+    memset(&result, 0, sizeof(QueryResult));
+    const float* origin = &scene.rays[6 * (size_t)r];
+    const float* direction = origin + 3;
+
+    result.hit.triangle = -1;
+    if (scene.bvh.intersect(origin, direction, 1e30f, result.hit))
+    {
+        // the node weighs the hit point against the triangle vertices
+        const int* triangle = scene.bvh.triangleVertices(result.hit.triangle);
+        const float* points = scene.mesh.points.data();
+        float point[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            point[k] = origin[k] + result.hit.t * direction[k];
+        }
+        result.weights = get_vertex_weight(&points[3 * triangle[0]], &points[3 * triangle[1]],
+            &points[3 * triangle[2]], point);
+    }
+
+    scene.bvh.intersectAll(origin, direction, 1e30f, all);
+    result.all_hits = (int)all.size();
+    for (int k = 0; k < std::min(4, result.all_hits); ++k)
+    {
+        result.all_t[k] = all[k].t;
+    }
+
+    result.occluded = scene.bvh.occluded(origin, direction, 1e30f);
+
+    // ray origins double as query points, most of them are too far from the surface
+    result.point.triangle = -1;
+    const float query_point[3] = { 0.4f * origin[0], 0.4f * origin[1], 0.4f * origin[2] };
+    scene.bvh.closestPoint(query_point, STRESS_QUERY_DISTANCE, result.point);
+
+    result.scene_mesh = -1;
+    result.scene_hit.triangle = -1;
+    scene.scene.intersect(origin, direction, 1e30f, result.scene_mesh, result.scene_hit);
+}
+
+static int count_mismatches(const std::vector<QueryResult>& expected, const std::vector<QueryResult>& results)
+{
+    int mismatches = 0;
+    for (size_t r = 0; r < expected.size(); ++r)
+    {
+        if (memcmp(&expected[r], &results[r], sizeof(QueryResult)) != 0) ++mismatches;
+    }
+    return mismatches;
+}
+
+int main(int argc, char** argv)
+{
+    const int num_threads = argc > 1 ? atoi(argv[1]) :
+        (int)std::max(16u, 4 * std::thread::hardware_concurrency());
+    const int num_rays = argc > 2 ? atoi(argv[2]) : 10000;
+    const int rounds = argc > 3 ? atoi(argv[3]) : 2;
+    if (num_threads < 1 || num_rays < 1 || rounds < 1) return 1;
+
+    Scene scene;
+    build_sphere(48, scene.mesh);
+    build_rays(num_rays, scene.rays);
+    const int num_triangles = (int)scene.mesh.triangle_vertices.size() / 3;
+    scene.moved = scene.mesh.points;
+    for (size_t k = 0; k < scene.moved.size(); k += 3)
+    {
+        scene.moved[k] += 1.5f;
+    }
+    scene.bvh.build(scene.mesh.points.data(), scene.mesh.triangle_vertices.data(), num_triangles);
+    scene.moved_bvh.build(scene.moved.data(), scene.mesh.triangle_vertices.data(), num_triangles);
+    scene.scene.build({ &scene.bvh, &scene.moved_bvh });
+
+    std::vector<QueryResult> expected(num_rays);
+    std::vector<RayHit> all;
+    for (int r = 0; r < num_rays; ++r)
+    {
+        query(scene, r, all, expected[r]);
+    }
+
+    // every thread runs every ray, from its own starting ray, into its own results
+    std::vector<std::vector<QueryResult>> results(num_threads, std::vector<QueryResult>(num_rays));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i)
+    {
+        threads.emplace_back([&, i]() {
+            std::vector<RayHit> thread_all;
+            const int first = (int)((long long)i * num_rays / num_threads);
+            for (int round = 0; round < rounds; ++round)
+            {
+                for (int k = 0; k < num_rays; ++k)
+                {
+                    const int r = (first + k) % num_rays;
+                    query(scene, r, thread_all, results[i][r]);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < num_threads; ++i)
+    {
+        mismatches += count_mismatches(expected, results[i]);
+    }
+
+    // the split the node uses, small grains so the chunks interleave
+    std::vector<QueryResult> chunked(num_rays);
+    parallel_for(0, num_rays, 16, [&](int begin, int end) {
+        std::vector<RayHit> chunk_all;
+        for (int r = begin; r < end; ++r)
+        {
+            query(scene, r, chunk_all, chunked[r]);
+        }
+    });
+    const int chunked_mismatches = count_mismatches(expected, chunked);
+
+    int num_hits = 0;
+    for (int r = 0; r < num_rays; ++r)
+    {
+        num_hits += expected[r].hit.triangle >= 0;
+    }
+
+    printf("mesh %d triangles, %d rays, %d hits\n", num_triangles, num_rays, num_hits);
+    printf("%d threads x %d rounds  %s\n", num_threads, rounds,
+        mismatches ? "DIFFER from serial" : "identical to serial");
+    printf("parallel_for          %s\n", chunked_mismatches ? "DIFFERS from serial" : "identical to serial");
+    if (mismatches) printf("  %d mismatching results\n", mismatches);
+
+    return mismatches || chunked_mismatches ? 1 : 0;
+}
@@ -0,0 +1,591 @@
+#include "triangleBVH.h"
+#include "rayTriangle.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+#define BVH_NUM_BINS 16
+#define BVH_MIN_LEAF_SIZE 2
+#define BVH_MAX_LEAF_SIZE RAY_PACKET_WIDTH
+// one packet tests a whole leaf at once, small nodes only split when it halves the cost
+#define BVH_PACKET_SPLIT_RATIO 0.5f
+#define BVH_MAX_SAH_DEPTH 48
+#define BVH_STACK_SIZE 128
+
+static void grow_bounds(float* bmin, float* bmax, const float* point);
+static float surface_area(const float* bmin, const float* bmax);
+static float box_distance2(const TriangleBVH::Node& node, const float point[3]);
+
+void TriangleBVH::clear()
+{
+    _nodes.clear();
+    _indices.clear();
+    _triangles.clear();
+    _packets.clear();
+}
+
+void TriangleBVH::build(const float* points, const int* triangle_vertices, int num_triangles)
+{
+    clear();
+    if (num_triangles <= 0) return;
+
+    _triangles.assign(triangle_vertices, triangle_vertices + 3 * num_triangles);
+    _indices.resize(num_triangles);
+
+    // per triangle bounds and centroids, only needed while building
+    std::vector<float> centroids(3 * num_triangles);
+    std::vector<float> tri_min(3 * num_triangles);
+    std::vector<float> tri_max(3 * num_triangles);
+    for (int i = 0; i < num_triangles; ++i)
+    {
+        _indices[i] = i;
+        const float* p0 = points + 3 * _triangles[3 * i];
+        const float* p1 = points + 3 * _triangles[3 * i + 1];
+        const float* p2 = points + 3 * _triangles[3 * i + 2];
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+            tri_min[3 * i + k] = std::min(p0[k], std::min(p1[k], p2[k]));
+            tri_max[3 * i + k] = std::max(p0[k], std::max(p1[k], p2[k]));
+            centroids[3 * i + k] = (tri_min[3 * i + k] + tri_max[3 * i + k]) * 0.5f;
+        }
+    }
+
+    _nodes.reserve(2 * num_triangles);
+    Node root;
+    root.left_first = 0;
+    root.count = num_triangles;
+    updateLeafBounds(root, points);
+    _nodes.push_back(root);
+
+    // children are always stored after their parent, refit relies on it
+    std::vector<std::pair<int, int>> stack(1, std::make_pair(0, 0));
+    while (!stack.empty())
+    {
+        const int node_id = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+
+        const int first = _nodes[node_id].left_first;
+        const int count = _nodes[node_id].count;
+        if (count <= BVH_MIN_LEAF_SIZE) continue;
+
+        // centroid bounds drive the binning
+        float cmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float cmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (int i = first; i < first + count; ++i)
+        {
+            grow_bounds(cmin, cmax, &centroids[3 * _indices[i]]);
+        }
+
+        // binned surface area heuristic over the three axes
+        float best_cost = FLT_MAX;
+        int best_axis = -1;
+        int best_bin = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = cmax[axis] - cmin[axis];
+            if (extent <= 0.f) continue;
+            float bin_scale = BVH_NUM_BINS / extent;
+
+            int bin_count[BVH_NUM_BINS] = { 0 };
+            float bin_min[BVH_NUM_BINS][3];
+            float bin_max[BVH_NUM_BINS][3];
+            for (int b = 0; b < BVH_NUM_BINS; ++b)
+            {
+                bin_min[b][0] = bin_min[b][1] = bin_min[b][2] = FLT_MAX;
+                bin_max[b][0] = bin_max[b][1] = bin_max[b][2] = -FLT_MAX;
+            }
+
+            for (int i = first; i < first + count; ++i)
+            {
+                const int tri = _indices[i];
+                int b = std::min(BVH_NUM_BINS - 1,
+                    (int)((centroids[3 * tri + axis] - cmin[axis]) * bin_scale));
+                bin_count[b]++;
+                grow_bounds(bin_min[b], bin_max[b], &tri_min[3 * tri]);
+                grow_bounds(bin_min[b], bin_max[b], &tri_max[3 * tri]);
+            }
+
+            // sweep from the right to get the area of every right side
+            float right_area[BVH_NUM_BINS];
+            int right_count[BVH_NUM_BINS];
+            float rmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float rmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            int rcount = 0;
+            for (int b = BVH_NUM_BINS - 1; b > 0; --b)
+            {
+                if (bin_count[b])
+                {
+                    grow_bounds(rmin, rmax, bin_min[b]);
+                    grow_bounds(rmin, rmax, bin_max[b]);
+                }
+                rcount += bin_count[b];
+                right_count[b] = rcount;
+                right_area[b] = rcount ? surface_area(rmin, rmax) : 0.f;
+            }
+
+            float lmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float lmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            int lcount = 0;
+            for (int b = 0; b < BVH_NUM_BINS - 1; ++b)
+            {
+                if (bin_count[b])
+                {
+                    grow_bounds(lmin, lmax, bin_min[b]);
+                    grow_bounds(lmin, lmax, bin_max[b]);
+                }
+                lcount += bin_count[b];
+                if (!lcount || !right_count[b + 1]) continue;
+
+                float cost = lcount * surface_area(lmin, lmax) +
+                    right_count[b + 1] * right_area[b + 1];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        const Node& node = _nodes[node_id];
+        float leaf_cost = count * surface_area(node.bmin, node.bmax);
+        if (count <= BVH_MAX_LEAF_SIZE &&
+            (best_axis < 0 || best_cost >= BVH_PACKET_SPLIT_RATIO * leaf_cost)) continue;
+
+        int left_count = count / 2;
+        if (best_axis >= 0)
+        {
+            const float split_scale = BVH_NUM_BINS / (cmax[best_axis] - cmin[best_axis]);
+            const float split_min = cmin[best_axis];
+            int* middle = std::partition(&_indices[first], &_indices[first] + count,
+                [&](int tri) {
+                    int b = std::min(BVH_NUM_BINS - 1,
+                        (int)((centroids[3 * tri + best_axis] - split_min) * split_scale));
+                    return b <= best_bin;
+                });
+            left_count = (int)(middle - &_indices[first]);
+        }
+        // else all centroids on the same spot, any halving of the range works
+
+        if (best_axis >= 0 &&
+            (left_count == 0 || left_count == count || depth >= BVH_MAX_SAH_DEPTH))
+        {
+            // degenerate or too deep for the traversal stack, fall back to a median split
+            left_count = count / 2;
+            std::nth_element(&_indices[first], &_indices[first] + left_count,
+                &_indices[first] + count,
+                [&](int a, int b) {
+                    return centroids[3 * a + best_axis] < centroids[3 * b + best_axis];
+                });
+        }
+
+        Node left;
+        left.left_first = first;
+        left.count = left_count;
+        updateLeafBounds(left, points);
+
+        Node right;
+        right.left_first = first + left_count;
+        right.count = count - left_count;
+        updateLeafBounds(right, points);
+
+        int left_id = (int)_nodes.size();
+        _nodes.push_back(left);
+        _nodes.push_back(right);
+
+        _nodes[node_id].left_first = left_id;
+        _nodes[node_id].count = 0;
+
+        stack.push_back(std::make_pair(left_id, depth + 1));
+        stack.push_back(std::make_pair(left_id + 1, depth + 1));
+    }
+
+    // lay every leaf out on its own packet, leaf.left_first / RAY_PACKET_WIDTH is the packet
+    std::vector<int> leaf_indices;
+    leaf_indices.reserve(_indices.size() + RAY_PACKET_WIDTH * _nodes.size() / 2);
+    for (size_t i = 0; i < _nodes.size(); ++i)
+    {
+        Node& node = _nodes[i];
+        if (!node.count) continue;
+
+        int leaf_first = (int)leaf_indices.size();
+        leaf_indices.insert(leaf_indices.end(),
+            _indices.begin() + node.left_first, _indices.begin() + node.left_first + node.count);
+        leaf_indices.resize(leaf_first + RAY_PACKET_WIDTH, -1);
+        node.left_first = leaf_first;
+    }
+    _indices.swap(leaf_indices);
+
+    _packets.resize(_indices.size() / RAY_PACKET_WIDTH);
+    for (size_t i = 0; i < _nodes.size(); ++i)
+    {
+        if (_nodes[i].count) updatePacket(_nodes[i], points);
+    }
+}
+
+void TriangleBVH::refit(const float* points)
+{
+    // children are stored after their parents, so a reverse walk is bottom up
+    for (int i = (int)_nodes.size() - 1; i >= 0; --i)
+    {
+        Node& node = _nodes[i];
+        if (node.count)
+        {
+            updateLeafBounds(node, points);
+            updatePacket(node, points);
+            continue;
+        }
+
+        const Node& left = _nodes[node.left_first];
+        const Node& right = _nodes[node.left_first + 1];
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+            node.bmin[k] = std::min(left.bmin[k], right.bmin[k]);
+            node.bmax[k] = std::max(left.bmax[k], right.bmax[k]);
+        }
+    }
+}
+
+bool TriangleBVH::intersect(const float origin[3], const float direction[3], float max_t,
+    RayHit& hit) const
+{
+    if (_nodes.empty()) return false;
+
+    float inv_direction[3];
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        inv_direction[k] = direction[k] != 0.f ? 1.f / direction[k] : FLT_MAX;
+    }
+
+    bool found = false;
+    hit.t = max_t;
+
+    float t_near;
+    if (!intersect_box(_nodes[0], origin, inv_direction, hit.t, t_near)) return false;
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size)
+    {
+        const Node& node = _nodes[stack[--stack_size]];
+
+        if (node.count)
+        {
+            // the whole leaf in one packet test
+            const TrianglePacket& packet = _packets[node.left_first / RAY_PACKET_WIDTH];
+            float t, u, v;
+            int lane = intersect_packet(packet, origin, direction, hit.t, t, u, v);
+            if (lane >= 0)
+            {
+                hit.triangle = packet.triangle[lane];
+                hit.t = t;
+                hit.u = u;
+                hit.v = v;
+                found = true;
+            }
+            continue;
+        }
+
+        // visit the nearest child first
+        int near_id = node.left_first;
+        int far_id = node.left_first + 1;
+        float t_left, t_right;
+        bool hit_left = intersect_box(_nodes[near_id], origin, inv_direction, hit.t, t_left);
+        bool hit_right = intersect_box(_nodes[far_id], origin, inv_direction, hit.t, t_right);
+
+        if (hit_left && hit_right)
+        {
+            if (t_right < t_left) std::swap(near_id, far_id);
+            stack[stack_size++] = far_id;
+            stack[stack_size++] = near_id;
+        }
+        else if (hit_left)
+        {
+            stack[stack_size++] = near_id;
+        }
+        else if (hit_right)
+        {
+            stack[stack_size++] = far_id;
+        }
+    }
+
+    return found;
+}
+
+void TriangleBVH::intersectAll(const float origin[3], const float direction[3], float max_t,
+    std::vector<RayHit>& hits) const
+{
+    hits.clear();
+    if (_nodes.empty()) return;
+
+    float inv_direction[3];
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        inv_direction[k] = direction[k] != 0.f ? 1.f / direction[k] : FLT_MAX;
+    }
+
+    // no culling by the closest hit, every node along the ray is visited once
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size)
+    {
+        const Node& node = _nodes[stack[--stack_size]];
+
+        float t_near;
+        if (!intersect_box(node, origin, inv_direction, max_t, t_near)) continue;
+
+        if (node.count)
+        {
+            const TrianglePacket& packet = _packets[node.left_first / RAY_PACKET_WIDTH];
+            float lane_t[RAY_PACKET_WIDTH];
+            float lane_u[RAY_PACKET_WIDTH];
+            float lane_v[RAY_PACKET_WIDTH];
+            int mask = intersect_packet_mask(packet, origin, direction, max_t, lane_t, lane_u, lane_v);
+            for (int lane = 0; mask; ++lane, mask >>= 1)
+            {
+                if (!(mask & 1)) continue;
+                RayHit hit;
+                hit.triangle = packet.triangle[lane];
+                hit.t = lane_t[lane];
+                hit.u = lane_u[lane];
+                hit.v = lane_v[lane];
+                hits.push_back(hit);
+            }
+            continue;
+        }
+
+        stack[stack_size++] = node.left_first + 1;
+        stack[stack_size++] = node.left_first;
+    }
+
+    std::sort(hits.begin(), hits.end(), [](const RayHit& a, const RayHit& b) {
+        return a.t < b.t || (a.t == b.t && a.triangle < b.triangle);
+    });
+}
+
+bool TriangleBVH::occluded(const float origin[3], const float direction[3], float max_t) const
+{
+    if (_nodes.empty()) return false;
+
+    float inv_direction[3];
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        inv_direction[k] = direction[k] != 0.f ? 1.f / direction[k] : FLT_MAX;
+    }
+
+    // shadow rays only need a yes or no, node order does not matter
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size)
+    {
+        const Node& node = _nodes[stack[--stack_size]];
+
+        float t_near;
+        if (!intersect_box(node, origin, inv_direction, max_t, t_near)) continue;
+
+        if (node.count)
+        {
+            const TrianglePacket& packet = _packets[node.left_first / RAY_PACKET_WIDTH];
+            float lane_t[RAY_PACKET_WIDTH];
+            float lane_u[RAY_PACKET_WIDTH];
+            float lane_v[RAY_PACKET_WIDTH];
+            if (intersect_packet_mask(packet, origin, direction, max_t, lane_t, lane_u, lane_v)) return true;
+            continue;
+        }
+
+        stack[stack_size++] = node.left_first + 1;
+        stack[stack_size++] = node.left_first;
+    }
+
+    return false;
+}
+
+bool TriangleBVH::closestPoint(const float point[3], float max_distance, PointHit& hit) const
+{
+    if (_nodes.empty()) return false;
+
+    // squared distances all the way, the search radius shrinks with every closer triangle
+    bool found = false;
+    float best2 = max_distance * max_distance;
+    if (box_distance2(_nodes[0], point) > best2) return false;
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size)
+    {
+        const Node& node = _nodes[stack[--stack_size]];
+        if (box_distance2(node, point) > best2) continue;
+
+        if (node.count)
+        {
+            const TrianglePacket& packet = _packets[node.left_first / RAY_PACKET_WIDTH];
+            for (int lane = 0; lane < packet.count; ++lane)
+            {
+                const float v0[3] = { packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane] };
+                const float e1[3] = { packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane] };
+                const float e2[3] = { packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane] };
+                float u, v;
+                const float distance2 = closest_point_on_triangle(v0, e1, e2, point, u, v);
+                if (distance2 > best2) continue;
+
+                best2 = distance2;
+                hit.triangle = packet.triangle[lane];
+                hit.u = u;
+                hit.v = v;
+                found = true;
+            }
+            continue;
+        }
+
+        // visit the nearest child first, the far one is often culled by then
+        int near_id = node.left_first;
+        int far_id = node.left_first + 1;
+        const float d_left = box_distance2(_nodes[near_id], point);
+        const float d_right = box_distance2(_nodes[far_id], point);
+        if (d_right < d_left) std::swap(near_id, far_id);
+
+        if (std::max(d_left, d_right) <= best2) stack[stack_size++] = far_id;
+        if (std::min(d_left, d_right) <= best2) stack[stack_size++] = near_id;
+    }
+
+    if (found) hit.distance = sqrtf(best2);
+    return found;
+}
+
+void TriangleBVH::updatePacket(const Node& node, const float* points)
+{
+    fill_triangle_packet(_packets[node.left_first / RAY_PACKET_WIDTH],
+        &_indices[node.left_first], node.count, _triangles.data(), points);
+}
+
+void TriangleBVH::updateLeafBounds(Node& node, const float* points) const
+{
+    node.bmin[0] = node.bmin[1] = node.bmin[2] = FLT_MAX;
+    node.bmax[0] = node.bmax[1] = node.bmax[2] = -FLT_MAX;
+
+    for (int i = node.left_first; i < node.left_first + node.count; ++i)
+    {
+        const int* ids = &_triangles[3 * _indices[i]];
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+            grow_bounds(node.bmin, node.bmax, points + 3 * ids[k]);
+        }
+    }
+}
+
+
+float closest_point_on_triangle(const float v0[3], const float e1[3], const float e2[3],
+    const float point[3], float& u, float& v)
+{
+    // voronoi regions of the vertices, edges and face (Ericson, Real-Time Collision Detection)
+    const float* ab = e1;
+    const float* ac = e2;
+    const float ap[3] = { point[0] - v0[0], point[1] - v0[1], point[2] - v0[2] };
+
+    const float d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+    const float d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+    const float ab_ab = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+    const float ab_ac = ab[0] * ac[0] + ab[1] * ac[1] + ab[2] * ac[2];
+    const float ac_ac = ac[0] * ac[0] + ac[1] * ac[1] + ac[2] * ac[2];
+
+    // dot products of bp and cp with the edges, without forming bp and cp
+    const float d3 = d1 - ab_ab;
+    const float d4 = d2 - ab_ac;
+    const float d5 = d1 - ab_ac;
+    const float d6 = d2 - ac_ac;
+
+    const float vc = d1 * d4 - d3 * d2;
+    const float vb = d5 * d2 - d1 * d6;
+    const float va = d3 * d6 - d5 * d4;
+
+    if (d1 <= 0.f && d2 <= 0.f)
+    {
+        u = 0.f;
+        v = 0.f;
+    }
+    else if (d3 >= 0.f && d4 <= d3)
+    {
+        u = 1.f;
+        v = 0.f;
+    }
+    else if (d6 >= 0.f && d5 <= d6)
+    {
+        u = 0.f;
+        v = 1.f;
+    }
+    else if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+    {
+        u = d1 / (d1 - d3);
+        v = 0.f;
+    }
+    else if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+    {
+        u = 0.f;
+        v = d2 / (d2 - d6);
+    }
+    else if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+    {
+        v = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        u = 1.f - v;
+    }
+    else
+    {
+        // degenerate triangles end up here with a zero sum, the first vertex stands in
+        const float sum = va + vb + vc;
+        const float inv_sum = sum != 0.f ? 1.f / sum : 0.f;
+        u = vb * inv_sum;
+        v = vc * inv_sum;
+    }
+
+    float distance2 = 0.f;
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        const float d = ap[k] - u * ab[k] - v * ac[k];
+        distance2 += d * d;
+    }
+
+    return distance2;
+}
+
+
+static void grow_bounds(float* bmin, float* bmax, const float* point)
+{
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        bmin[k] = std::min(bmin[k], point[k]);
+        bmax[k] = std::max(bmax[k], point[k]);
+    }
+}
+
+
+static float surface_area(const float* bmin, const float* bmax)
+{
+    float dx = bmax[0] - bmin[0];
+    float dy = bmax[1] - bmin[1];
+    float dz = bmax[2] - bmin[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+
+static float box_distance2(const TriangleBVH::Node& node, const float point[3])
+{
+    float distance2 = 0.f;
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        const float d = std::max(std::max(node.bmin[k] - point[k], point[k] - node.bmax[k]), 0.f);
+        distance2 += d * d;
+    }
+
+    return distance2;
+}
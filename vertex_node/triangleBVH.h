@@ -0,0 +1,107 @@
+#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "rayTriangle.h"
+
+/*
+Bounding volume hierarchy over the triangles of a mesh.
+Independent from the Maya API, works over a flat triangle-to-vertex table
+(three vertex ids per triangle) and a flat xyz float array of points.
+Leaves hold up to RAY_PACKET_WIDTH triangles, copied into a packet that
+is tested at once, so queries never read the points array: it is only
+needed by build() and refit(), which must be called after points move.
+*/
+
+struct RayHit
+{
+    int triangle;  // index in the triangle table
+    float t;       // ray parameter, in units of the ray direction
+    float u, v;    // barycentric coordinates of the second and third vertex
+};
+
+struct PointHit
+{
+    int triangle;    // index in the triangle table
+    float distance;  // from the query point to the closest point
+    float u, v;      // barycentric coordinates of the second and third vertex
+};
+
+// squared distance from point to the triangle v0, v0 + e1, v0 + e2, u and v locate the closest point
+float closest_point_on_triangle(const float v0[3], const float e1[3], const float e2[3],
+    const float point[3], float& u, float& v);
+
+class TriangleBVH
+{
+public:
+    struct Node
+    {
+        float bmin[3];
+        float bmax[3];
+        int left_first;  // left child for inner nodes, packet aligned first index for leaves
+        int count;       // number of triangles, 0 for inner nodes
+    };
+
+    TriangleBVH() {}
+
+    // build the tree from scratch, copies the triangle table
+    void build(const float* points, const int* triangle_vertices, int num_triangles);
+
+    // recompute node bounds for new point positions, same topology
+    void refit(const float* points);
+
+    void clear();
+
+    // closest hit with 0 <= t <= max_t
+    bool intersect(const float origin[3], const float direction[3], float max_t,
+        RayHit& hit) const;
+
+    // every hit with 0 <= t <= max_t in one traversal, sorted by t
+    void intersectAll(const float origin[3], const float direction[3], float max_t,
+        std::vector<RayHit>& hits) const;
+
+    // any hit with 0 <= t <= max_t, stops at the first one found
+    bool occluded(const float origin[3], const float direction[3], float max_t) const;
+
+    // closest point on the surface within max_distance of point
+    bool closestPoint(const float point[3], float max_distance, PointHit& hit) const;
+
+    bool empty() const { return _nodes.empty(); }
+    const Node& root() const { return _nodes[0]; }
+    int numTriangles() const { return (int)_triangles.size() / 3; }
+    const int* triangleVertices(int triangle) const { return &_triangles[3 * triangle]; }
+
+private:
+    void updateLeafBounds(Node& node, const float* points) const;
+    void updatePacket(const Node& node, const float* points);
+
+    std::vector<Node> _nodes;
+    std::vector<int> _indices;    // triangle ids, one RAY_PACKET_WIDTH slot per leaf, -1 padded
+    std::vector<int> _triangles;  // three vertex ids per triangle
+    std::vector<TrianglePacket> _packets;  // one per leaf, refreshed by refit
+};
+
+// slab test of a node box against a ray, t_near is where the ray enters it. inline, the
+// triangle and the scene traversals both test two boxes per step
+inline bool intersect_box(const TriangleBVH::Node& node, const float origin[3],
+    const float inv_direction[3], float max_t, float& t_near)
+{
+    float t_min = 0.f;
+    float t_max = max_t;
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        float t0 = (node.bmin[k] - origin[k]) * inv_direction[k];
+        float t1 = (node.bmax[k] - origin[k]) * inv_direction[k];
+        if (t0 > t1) std::swap(t0, t1);
+        t_min = std::max(t_min, t0);
+        t_max = std::min(t_max, t1);
+    }
+
+    t_near = t_min;
+    return t_min <= t_max;
+}
+
+#endif // !TRIANGLE_BVH_H
@@ -0,0 +1,172 @@
+#include "uvRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+#include "../common/parallelFor.h"
+
+// pixels per tile side, a tile of floats fits in l1
+#define UV_TILE_SIZE 32
+
+void UVRasterizer::rasterize(const float* uvs, const int* triangle_uvs, const int* triangle_vertices,
+    int num_triangles, const float* vertex_weights, int width, int height,
+    std::vector<float>& image)
+{
+    image.assign((size_t)std::max(0, width) * std::max(0, height), 0.f);
+    _touched_tiles.clear();
+    if (width <= 0 || height <= 0) return;
+
+    _width = width;
+    _height = height;
+    _tiles_x = (width + UV_TILE_SIZE - 1) / UV_TILE_SIZE;
+    _tiles_y = (height + UV_TILE_SIZE - 1) / UV_TILE_SIZE;
+    const int num_tiles = _tiles_x * _tiles_y;
+
+    // 1. tile bounds of every triangle that carries weight, counted per tile
+    _tile_offsets.assign(num_tiles + 1, 0);
+    _triangle_tiles.assign(4 * num_triangles, -1);
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* uv_ids = &triangle_uvs[3 * tri];
+        const int* ids = &triangle_vertices[3 * tri];
+        if (uv_ids[0] < 0 || uv_ids[1] < 0 || uv_ids[2] < 0) continue;
+        if (vertex_weights[ids[0]] == 0.f && vertex_weights[ids[1]] == 0.f &&
+            vertex_weights[ids[2]] == 0.f) continue;
+
+        float u_min = uvs[2 * uv_ids[0]], u_max = u_min;
+        float v_min = uvs[2 * uv_ids[0] + 1], v_max = v_min;
+        for (unsigned int i = 1; i < 3; ++i)
+        {
+            u_min = std::min(u_min, uvs[2 * uv_ids[i]]);
+            u_max = std::max(u_max, uvs[2 * uv_ids[i]]);
+            v_min = std::min(v_min, uvs[2 * uv_ids[i] + 1]);
+            v_max = std::max(v_max, uvs[2 * uv_ids[i] + 1]);
+        }
+
+        // pixels whose center can fall inside, clamped to the image
+        const int x0 = std::max(0, (int)std::ceil(u_min * width - 0.5f));
+        const int x1 = std::min(width - 1, (int)std::floor(u_max * width - 0.5f));
+        const int y0 = std::max(0, (int)std::ceil(v_min * height - 0.5f));
+        const int y1 = std::min(height - 1, (int)std::floor(v_max * height - 0.5f));
+        if (x0 > x1 || y0 > y1) continue;
+
+        int* bounds = &_triangle_tiles[4 * tri];
+        bounds[0] = x0 / UV_TILE_SIZE;
+        bounds[1] = y0 / UV_TILE_SIZE;
+        bounds[2] = x1 / UV_TILE_SIZE;
+        bounds[3] = y1 / UV_TILE_SIZE;
+        for (int ty = bounds[1]; ty <= bounds[3]; ++ty)
+        {
+            for (int tx = bounds[0]; tx <= bounds[2]; ++tx)
+            {
+                _tile_offsets[ty * _tiles_x + tx + 1]++;
+            }
+        }
+    }
+
+    for (int tile = 0; tile < num_tiles; ++tile)
+    {
+        if (_tile_offsets[tile + 1]) _touched_tiles.push_back(tile);
+        _tile_offsets[tile + 1] += _tile_offsets[tile];
+    }
+    if (_touched_tiles.empty()) return;
+
+    // 2. counting sort, triangles stay in id order inside each tile
+    std::vector<int> fill(_tile_offsets.begin(), _tile_offsets.end() - 1);
+    _tile_triangles.resize(_tile_offsets[num_tiles]);
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* bounds = &_triangle_tiles[4 * tri];
+        if (bounds[0] < 0) continue;
+        for (int ty = bounds[1]; ty <= bounds[3]; ++ty)
+        {
+            for (int tx = bounds[0]; tx <= bounds[2]; ++tx)
+            {
+                _tile_triangles[fill[ty * _tiles_x + tx]++] = tri;
+            }
+        }
+    }
+
+    // 3. touched tiles only, each one owns its pixels
+    float* pixels = image.data();
+    parallel_for(0, (int)_touched_tiles.size(), 1, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            rasterizeTile(_touched_tiles[i], uvs, triangle_uvs, triangle_vertices, vertex_weights, pixels);
+        }
+    });
+}
+
+void UVRasterizer::rasterizeTile(int tile, const float* uvs, const int* triangle_uvs,
+    const int* triangle_vertices, const float* vertex_weights, float* image) const
+{
+    const int tile_x0 = (tile % _tiles_x) * UV_TILE_SIZE;
+    const int tile_y0 = (tile / _tiles_x) * UV_TILE_SIZE;
+    const int tile_x1 = std::min(_width, tile_x0 + UV_TILE_SIZE) - 1;
+    const int tile_y1 = std::min(_height, tile_y0 + UV_TILE_SIZE) - 1;
+
+    for (int k = _tile_offsets[tile]; k < _tile_offsets[tile + 1]; ++k)
+    {
+        const int tri = _tile_triangles[k];
+        const int* uv_ids = &triangle_uvs[3 * tri];
+        const int* ids = &triangle_vertices[3 * tri];
+
+        // triangle in pixel units
+        float x[3], y[3];
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            x[i] = uvs[2 * uv_ids[i]] * _width;
+            y[i] = uvs[2 * uv_ids[i] + 1] * _height;
+        }
+
+        const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area == 0.f) continue;
+        const float inv_area = 1.f / area;
+
+        const float w0 = vertex_weights[ids[0]];
+        const float w1 = vertex_weights[ids[1]];
+        const float w2 = vertex_weights[ids[2]];
+
+        // pixel bounds of the triangle clipped to the tile
+        const int x0 = std::max(tile_x0, (int)std::ceil(std::min(x[0], std::min(x[1], x[2])) - 0.5f));
+        const int x1 = std::min(tile_x1, (int)std::floor(std::max(x[0], std::max(x[1], x[2])) - 0.5f));
+        const int y0 = std::max(tile_y0, (int)std::ceil(std::min(y[0], std::min(y[1], y[2])) - 0.5f));
+        const int y1 = std::min(tile_y1, (int)std::floor(std::max(y[0], std::max(y[1], y[2])) - 0.5f));
+
+        for (int py = y0; py <= y1; ++py)
+        {
+            const float cy = py + 0.5f;
+            float* row = image + (size_t)py * _width;
+            for (int px = x0; px <= x1; ++px)
+            {
+                const float cx = px + 0.5f;
+
+                // edge functions normalized by the signed area, both windings work
+                const float b1 = ((cx - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (cy - y[0])) * inv_area;
+                const float b2 = ((x[1] - x[0]) * (cy - y[0]) - (cx - x[0]) * (y[1] - y[0])) * inv_area;
+                const float b0 = 1.f - b1 - b2;
+                if (b0 < 0.f || b1 < 0.f || b2 < 0.f) continue;
+
+                row[px] = b0 * w0 + b1 * w1 + b2 * w2;
+            }
+        }
+    }
+}
+
+bool write_raw_image(const std::string& path, const std::vector<float>& image)
+{
+    // same replace on success as the weight cache, a reader never sees half an image
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+
+        if (!image.empty()) file.write((const char*)image.data(), image.size() * sizeof(float));
+        if (!file) return false;
+    }
+
+    std::remove(path.c_str());
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
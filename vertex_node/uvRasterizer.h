@@ -0,0 +1,51 @@
+#ifndef UV_RASTERIZER_H
+#define UV_RASTERIZER_H
+
+#include <string>
+#include <vector>
+
+/*
+Splats per vertex weights into a float image over the 0..1 uv square.
+The image is cut in square tiles, triangles with a nonzero vertex weight
+are binned into the tiles their uv bounds overlap with a counting sort,
+then only the touched tiles are rasterized, one tile per worker task, so
+no two threads ever write the same pixel. Inside a triangle the weight is
+interpolated with the barycentrics of the pixel center.
+Rows go up in v, row 0 is v = 0, and a later triangle overwrites an
+earlier one where uv shells overlap.
+*/
+
+class UVRasterizer
+{
+public:
+    UVRasterizer() {}
+
+    // uvs are (u, v) pairs, triangle_uvs and triangle_vertices hold three ids per triangle,
+    // triangles with a negative uv id are skipped. image is resized and cleared first
+    void rasterize(const float* uvs, const int* triangle_uvs, const int* triangle_vertices,
+        int num_triangles, const float* vertex_weights, int width, int height,
+        std::vector<float>& image);
+
+    // tiles rasterized by the last call
+    int numTouchedTiles() const { return (int)_touched_tiles.size(); }
+
+private:
+    void rasterizeTile(int tile, const float* uvs, const int* triangle_uvs,
+        const int* triangle_vertices, const float* vertex_weights, float* image) const;
+
+    int _width=0;
+    int _height=0;
+    int _tiles_x=0;
+    int _tiles_y=0;
+
+    // triangle ids per tile, csr, kept between calls to avoid reallocating
+    std::vector<int> _tile_offsets;
+    std::vector<int> _tile_triangles;
+    std::vector<int> _touched_tiles;
+    std::vector<int> _triangle_tiles;  // pixel bounds in tiles, x0 y0 x1 y1 per triangle, -1 when skipped
+};
+
+// raw 32 bit floats in native byte order, row 0 first, replaces path only once complete
+bool write_raw_image(const std::string& path, const std::vector<float>& image);
+
+#endif // !UV_RASTERIZER_H
@@ -0,0 +1,247 @@
+#include "vertexDeformer.h"
+#include <maya/MFnMesh.h>
+#include <maya/MFloatPointArray.h>
+#include <maya/MPointArray.h>
+#include <maya/MIntArray.h>
+#include <maya/MArrayDataHandle.h>
+#include <maya/MPoint.h>
+#include <maya/MVector.h>
+#include <algorithm>
+#include <cmath>
+
+#include "../common/parallelFor.h"
+#include "nodeUtils.h"
+
+// same ray length as VertexNode
+#define MAX_RAY_PARAM 99.f
+// points per worker chunk in the falloff and displacement loops
+#define POINT_GRAIN_SIZE 1024
+
+MTypeId VertexDeformer::id(0x8104F);
+MString VertexDeformer::name("vertexDeformer");
+
+// attributes
+MObject VertexDeformer::aPoint;
+MObject VertexDeformer::aPointX;
+MObject VertexDeformer::aPointY;
+MObject VertexDeformer::aPointZ;
+MObject VertexDeformer::aVector;
+MObject VertexDeformer::aVectorX;
+MObject VertexDeformer::aVectorY;
+MObject VertexDeformer::aVectorZ;
+MObject VertexDeformer::aFalloffRadius;
+MObject VertexDeformer::aAmount;
+
+void* VertexDeformer::creator()
+{
+    return new VertexDeformer;
+}
+
+MStatus VertexDeformer::initialize()
+{
+    MFnNumericAttribute nAttr;
+
+    aPointX = nAttr.create("pointX", "pX", MFnNumericData::kFloat);
+    aPointY = nAttr.create("pointY", "pY", MFnNumericData::kFloat);
+    aPointZ = nAttr.create("pointZ", "pZ", MFnNumericData::kFloat);
+    aPoint = nAttr.create("point", "p", aPointX, aPointY, aPointZ);
+    MAKE_INPUT(nAttr);
+    addAttribute(aPoint);
+
+    aVectorX = nAttr.create("vectorX", "vX", MFnNumericData::kFloat);
+    aVectorY = nAttr.create("vectorY", "vY", MFnNumericData::kFloat);
+    aVectorZ = nAttr.create("vectorZ", "vZ", MFnNumericData::kFloat);
+    aVector = nAttr.create("vector", "v", aVectorX, aVectorY, aVectorZ);
+    MAKE_INPUT(nAttr);
+    addAttribute(aVector);
+
+    aFalloffRadius = nAttr.create("falloffRadius", "for", MFnNumericData::kFloat, 1.0);
+    nAttr.setMin(0.0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aFalloffRadius);
+
+    aAmount = nAttr.create("amount", "amt", MFnNumericData::kFloat, 1.0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aAmount);
+
+    // attribute affects
+    CHECK_MSTATUS(attributeAffects(aPoint, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aPointX, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aPointY, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aPointZ, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aVector, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aVectorX, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aVectorY, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aVectorZ, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aFalloffRadius, outputGeom));
+    CHECK_MSTATUS(attributeAffects(aAmount, outputGeom));
+
+    return MS::kSuccess;
+}
+
+MStatus VertexDeformer::deform(MDataBlock& data, MItGeometry& iter, const MMatrix& matrix,
+    unsigned int multi_index)
+{
+    MStatus status;
+
+    const float envelope_value = data.inputValue(envelope).asFloat();
+    if (envelope_value == 0.f) return MS::kSuccess;
+
+    InputGeometry* geometry = nullptr;
+    status = updateAccelerator(data, multi_index, geometry);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    // nurbs, lattices and curves in the deformer set have nothing to trace, left as they are
+    if (!geometry) return MS::kSuccess;
+    const TriangleBVH& bvh = geometry->bvh;
+    const std::vector<float>& points = geometry->points;
+    if (bvh.empty()) return MS::kSuccess;
+
+    // the ray comes in world space, the geometry is deformed in object space
+    const float3& position = data.inputValue(aPoint).asFloat3();
+    const float3& vector = data.inputValue(aVector).asFloat3();
+    const MMatrix world_to_object = matrix.inverse();
+    const MPoint local_position = MPoint(position[0], position[1], position[2]) * world_to_object;
+    const MVector local_vector = MVector(vector[0], vector[1], vector[2]) * world_to_object;
+    const float origin[3] = { (float)local_position.x, (float)local_position.y, (float)local_position.z };
+    const float direction[3] = { (float)local_vector.x, (float)local_vector.y, (float)local_vector.z };
+
+    RayHit hit;
+    if (!bvh.intersect(origin, direction, MAX_RAY_PARAM, hit)) return MS::kSuccess;
+
+    const float hit_point[3] = {
+        origin[0] + hit.t * direction[0],
+        origin[1] + hit.t * direction[1],
+        origin[2] + hit.t * direction[2] };
+    const int* hit_vertices = bvh.triangleVertices(hit.triangle);
+    const float hit_weights[3] = { 1.f - hit.u - hit.v, hit.u, hit.v };
+
+    MPointArray positions;
+    status = iter.allPositions(positions, MSpace::kObject);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    const int num_points = (int)positions.length();
+
+    // a partial deformer set iterates a subset of the vertices, keep their ids
+    std::vector<int> vertex_ids;
+    if (num_points != (int)points.size() / 3)
+    {
+        vertex_ids.reserve(num_points);
+        for (iter.reset(); !iter.isDone(); iter.next())
+        {
+            vertex_ids.push_back(iter.index());
+        }
+    }
+
+    // 1. ray weight of every point, radius falloff or the hit triangle barycentrics
+    const float falloff_radius = data.inputValue(aFalloffRadius).asFloat();
+    std::vector<float> weights(num_points, 0.f);
+    parallel_for(0, num_points, POINT_GRAIN_SIZE, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            const int vertex = vertex_ids.empty() ? i : vertex_ids[i];
+            if (falloff_radius > 0.f)
+            {
+                const float* p = &points[3 * vertex];
+                const float dx = p[0] - hit_point[0];
+                const float dy = p[1] - hit_point[1];
+                const float dz = p[2] - hit_point[2];
+                const float x2 = (dx * dx + dy * dy + dz * dz) / (falloff_radius * falloff_radius);
+                if (x2 < 1.f) weights[i] = (1.f - x2) * (1.f - x2);
+            }
+            else
+            {
+                for (unsigned int k = 0; k < 3; ++k)
+                {
+                    if (hit_vertices[k] == vertex) weights[i] = hit_weights[k];
+                }
+            }
+        }
+    });
+
+    // 2. painted weights, weightValue reads the data block so it stays on this thread,
+    // only the few points the ray reached need it
+    for (int i = 0; i < num_points; ++i)
+    {
+        if (weights[i] == 0.f) continue;
+        const int vertex = vertex_ids.empty() ? i : vertex_ids[i];
+        weights[i] *= weightValue(data, multi_index, vertex);
+    }
+
+    // 3. push along vector
+    const float scale = envelope_value * data.inputValue(aAmount).asFloat();
+    parallel_for(0, num_points, POINT_GRAIN_SIZE, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            if (weights[i] == 0.f) continue;
+            positions[i] += local_vector * (scale * weights[i]);
+        }
+    });
+
+    return iter.setAllPositions(positions, MSpace::kObject);
+}
+
+MStatus VertexDeformer::updateAccelerator(MDataBlock& data, unsigned int multi_index,
+    InputGeometry*& geometry)
+{
+    MStatus status;
+    geometry = nullptr;
+
+    MArrayDataHandle input_array = data.outputArrayValue(input, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    status = input_array.jumpToElement(multi_index);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    MObject mesh = input_array.outputValue().child(inputGeom).asMesh();
+    if (mesh.isNull())
+    {
+        _geometries.erase(multi_index);
+        return MS::kSuccess;
+    }
+
+    MFnMesh fnMesh(mesh, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MIntArray triangle_counts;
+    MIntArray triangle_vertices;
+    status = fnMesh.getTriangles(triangle_counts, triangle_vertices);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MFloatPointArray mesh_points;
+    status = fnMesh.getPoints(mesh_points, MSpace::kObject);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    // map nodes stay where they are, the pointer survives other elements being added
+    geometry = &_geometries[multi_index];
+    std::vector<float>& points = geometry->points;
+    TriangleBVH& bvh = geometry->bvh;
+
+    unsigned int num_verts = mesh_points.length();
+    points.resize(3 * num_verts);
+    for (unsigned int i = 0; i < num_verts; ++i)
+    {
+        points[3 * i] = mesh_points[i].x;
+        points[3 * i + 1] = mesh_points[i].y;
+        points[3 * i + 2] = mesh_points[i].z;
+    }
+
+    // the input geometry changes on every upstream deformation, a refit is O(n)
+    unsigned long long hash = topology_hash(num_verts, triangle_vertices);
+    int num_triangles = (int)triangle_vertices.length() / 3;
+    if (hash != geometry->topology_hash || bvh.numTriangles() != num_triangles)
+    {
+        if (num_triangles)
+        {
+            bvh.build(points.data(), &triangle_vertices[0], num_triangles);
+        }
+        else
+        {
+            bvh.clear();
+        }
+        geometry->topology_hash = hash;
+    }
+    else
+    {
+        bvh.refit(points.data());
+    }
+
+    return MS::kSuccess;
+}
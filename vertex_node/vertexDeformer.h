@@ -0,0 +1,73 @@
+#ifndef VERTEX_DEFORMER_H
+#define VERTEX_DEFORMER_H
+
+#include <map>
+#include <vector>
+
+#include <maya/MPxGeometryFilter.h>
+#include <maya/MItGeometry.h>
+#include <maya/MFnNumericAttribute.h>
+#include <maya/MDataBlock.h>
+#include <maya/MMatrix.h>
+#include <maya/MTypeId.h>
+#include <maya/MString.h>
+
+#include "triangleBVH.h"
+
+/*
+Deformer sibling of VertexNode: casts the point/vector ray against the mesh
+it deforms and pushes the hit area along vector, with no weight array
+connection in between. The ray is traced in object space, the falloff and
+displacement loops run across threads.
+*/
+class VertexDeformer : public MPxGeometryFilter
+{
+public:
+    VertexDeformer() {}
+    virtual ~VertexDeformer() override {}
+
+    static void* creator();
+    static MStatus initialize();
+
+    MStatus deform(MDataBlock& data, MItGeometry& iter, const MMatrix& matrix,
+        unsigned int multi_index) override;
+
+    SchedulingType schedulingType() const override { return kParallel; }
+
+private:
+    // one element of input, its tree is kept while the topology stays the same
+    struct InputGeometry
+    {
+        unsigned long long topology_hash=0;
+        std::vector<float> points;  // object space xyz
+        TriangleBVH bvh;
+    };
+
+    // rebuild the bvh of multi_index on a new triangle table, refit it otherwise.
+    // geometry is null when the input is not a mesh
+    MStatus updateAccelerator(MDataBlock& data, unsigned int multi_index, InputGeometry*& geometry);
+
+    // deform() runs once per input geometry, each keeps its own tree keyed by multi_index
+    std::map<unsigned int, InputGeometry> _geometries;
+
+public:
+    // attributes
+    static MObject aPoint;
+    static MObject aPointX;
+    static MObject aPointY;
+    static MObject aPointZ;
+
+    static MObject aVector;
+    static MObject aVectorX;
+    static MObject aVectorY;
+    static MObject aVectorZ;
+
+    static MObject aFalloffRadius;  // 0 moves the hit triangle only, by its barycentric weights
+    static MObject aAmount;         // displacement in units of vector
+
+    // node data
+    static MTypeId id;
+    static MString name;
+};
+
+#endif // !VERTEX_DEFORMER_H
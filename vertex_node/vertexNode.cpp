@@ -2,28 +2,68 @@
 #include <maya/MMeshIntersector.h>
 #include <maya/MFnMesh.h>
 #include <maya/MPointArray.h>
+#include <maya/MFloatPointArray.h>
+#include <maya/MIntArray.h>
+#include <maya/MFloatArray.h>
+#include <maya/MFnFloatArrayData.h>
+#include <maya/MFnIntArrayData.h>
 #include <maya/MArrayDataBuilder.h>
 #include <maya/MIOStream.h>
 #include <maya/MGlobal.h>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <utility>
 
-#define MAKE_INPUT(attr)                    \
-    CHECK_MSTATUS(attr.setKeyable(true));   \
-    CHECK_MSTATUS(attr.setStorable(true));  \
-    CHECK_MSTATUS(attr.setReadable(true));  \
-    CHECK_MSTATUS(attr.setWritable(true));
+#include "../common/parallelFor.h"
+#include "nodeUtils.h"
+#include "vertexWeights.h"
+#include <maya/MFnEnumAttribute.h>
+#include <maya/MFnUnitAttribute.h>
+#include <maya/MTime.h>
 
-#define MAKE_OUTPUT(attr)                   \
-    CHECK_MSTATUS(attr.setKeyable(false));  \
-    CHECK_MSTATUS(attr.setStorable(false)); \
-    CHECK_MSTATUS(attr.setReadable(true));  \
-    CHECK_MSTATUS(attr.setWritable(false));
+static inline float falloff_weight(float distance, float radius);
+static unsigned long long settings_hash(MDataBlock& data);
+static unsigned long long points_stamp(const float* points, unsigned int num_points);
+static unsigned long long input_stamp(const float3& position, const float3& vector,
+    const std::vector<float>& rays, const std::vector<float>& query_points,
+    unsigned long long points_stamp);
+static double elapsed_ms(const std::chrono::high_resolution_clock::time_point& start);
+static void read_batch_rays(MDataBlock& data, std::vector<unsigned int>& ray_indices,
+    std::vector<float>& rays);
+static void merge_coincident_hits(std::vector<RayHit>& hits);
+static void cone_direction(const float3& axis, float cone_angle, int sample, int num_samples,
+    float direction[3]);
+static void read_query_points(MDataBlock& data, std::vector<unsigned int>& query_indices,
+    std::vector<float>& query_points);
+static MStatus read_triangle_uvs(const MFnMesh& fnMesh, std::vector<int>& triangle_uvs,
+    std::vector<float>& uvs);
 
-static float* get_vertex_weight(
-    const float3& vertex1, const float3& vertex2, const float3& vertex3, const float3& point);
-static float dot(const float3 vector1, const float3 vector2);
-static float* cross_product(const float3 vector1, const float3 vector2);
-static float vector_magnitude(const float3 vector);
+// same ray length MFnMesh::closestIntersection was called with
+#define MAX_RAY_PARAM 99.f
+// rays traced per worker chunk in batched mode
+#define RAY_GRAIN_SIZE 64
+// shadow rays per worker chunk
+#define VISIBILITY_GRAIN_SIZE 256
+// shadow rays start and stop this fraction of the segment away from both ends,
+// so the faces around the vertex and a point lying on the surface do not block them
+#define VISIBILITY_EPSILON 1e-4f
+// cone rays per worker chunk, each chunk fills its own contribution buffer
+#define CONE_GRAIN_SIZE 16
+// closest point queries per worker chunk
+#define QUERY_GRAIN_SIZE 64
+// geodesic hit solves per worker chunk, more hits are spread over at most
+// GEODESIC_MAX_CHUNKS chunks since each chunk keeps vertex sized scratch
+#define GEODESIC_GRAIN_SIZE 2
+#define GEODESIC_MAX_CHUNKS 32
+// hits closer than this along the ray, relative past t = 1, are one crossing through a
+// shared edge or vertex
+#define HIT_MERGE_EPSILON 1e-5f
+// triangles tested around a cached hit before falling back to the bvh
+#define HIT_CACHE_MAX_TRIANGLES 64
+// frames further than this from a whole frame are subframes, never read from a bake
+#define CACHE_FRAME_EPSILON 1e-6
 
 MTypeId VertexNode::id(0x8104E);
 MString VertexNode::name("vertexNode");
@@ -31,6 +71,11 @@ MString VertexNode::name("vertexNode");
 // attributes
 MObject VertexNode::aInputMesh;
 MObject VertexNode::aOutput;
+MObject VertexNode::aOutputWeights;
+MObject VertexNode::aVisibility;
+MObject VertexNode::aUVResolution;
+MObject VertexNode::aUVFile;
+MObject VertexNode::aUVWeights;
 MObject VertexNode::aPoint;
 MObject VertexNode::aPointX;
 MObject VertexNode::aPointY;
@@ -39,6 +84,37 @@ MObject VertexNode::aVector;
 MObject VertexNode::aVectorX;
 MObject VertexNode::aVectorY;
 MObject VertexNode::aVectorZ;
+MObject VertexNode::aProfile;
+MObject VertexNode::aSparseOutput;
+MObject VertexNode::aHitCache;
+MObject VertexNode::aConeAngle;
+MObject VertexNode::aConeSamples;
+MObject VertexNode::aFalloff;
+MObject VertexNode::aFalloffRadius;
+MObject VertexNode::aFalloffRings;
+MObject VertexNode::aGeodesicDeform;
+MObject VertexNode::aRayOrigin;
+MObject VertexNode::aRayDirection;
+MObject VertexNode::aRayVertices;
+MObject VertexNode::aRayWeights;
+MObject VertexNode::aQueryPoint;
+MObject VertexNode::aQueryMaxDistance;
+MObject VertexNode::aQueryVertices;
+MObject VertexNode::aQueryWeights;
+MObject VertexNode::aInputMeshes;
+MObject VertexNode::aHitMesh;
+MObject VertexNode::aHitMeshVertices;
+MObject VertexNode::aHitMeshWeights;
+MObject VertexNode::aQueryDistances;
+MObject VertexNode::aSDFBrickSize;
+MObject VertexNode::aSDFMemoryBudget;
+MObject VertexNode::aMultiHit;
+MObject VertexNode::aHitDistances;
+MObject VertexNode::aHitVertices;
+MObject VertexNode::aHitWeights;
+MObject VertexNode::aTime;
+MObject VertexNode::aCacheFile;
+MObject VertexNode::aUseCache;
 
 void* VertexNode::creator()
 {
@@ -51,11 +127,19 @@ MStatus VertexNode::initialize()
 
     MFnTypedAttribute mAttr;
     MFnNumericAttribute nAttr;
+    MFnEnumAttribute eAttr;
+    MFnUnitAttribute uAttr;
 
     aInputMesh = mAttr.create("inputMesh", "im", MFnMeshData::kMesh);
     mAttr.setStorable(true);
     addAttribute(aInputMesh);
 
+    // several meshes hit by the point/vector ray, independent of inputMesh
+    aInputMeshes = mAttr.create("inputMeshes", "ims", MFnMeshData::kMesh);
+    mAttr.setStorable(true);
+    mAttr.setArray(true);
+    addAttribute(aInputMeshes);
+
     aPointX = nAttr.create("pointX", "pX", MFnNumericData::kFloat);
     aPointY = nAttr.create("pointY", "pY", MFnNumericData::kFloat);
     aPointZ = nAttr.create("pointZ", "pZ", MFnNumericData::kFloat);
@@ -70,6 +154,121 @@ MStatus VertexNode::initialize()
     MAKE_INPUT(nAttr);
     addAttribute(aVector);
 
+    aProfile = nAttr.create("profile", "prf", MFnNumericData::kBoolean, 0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aProfile);
+
+    aSparseOutput = nAttr.create("sparseOutput", "so", MFnNumericData::kBoolean, 0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aSparseOutput);
+
+    // coherent rays in playback, the neighbourhood of the last hit is tested first.
+    // a hit there is kept only when an occluded query finds nothing in front of it,
+    // otherwise the ray walks the whole bvh
+    aHitCache = nAttr.create("hitCache", "hc", MFnNumericData::kBoolean, 0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aHitCache);
+
+    // soft brush, stratified rays inside a cone around vector replace the single ray
+    aConeAngle = nAttr.create("coneAngle", "ca", MFnNumericData::kFloat, 0.0);
+    nAttr.setMin(0.0);
+    nAttr.setMax(90.0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aConeAngle);
+
+    aConeSamples = nAttr.create("coneSamples", "cs", MFnNumericData::kInt, 16);
+    nAttr.setMin(1);
+    MAKE_INPUT(nAttr);
+    addAttribute(aConeSamples);
+
+    // how hit weights spread over the mesh
+    aFalloff = eAttr.create("falloff", "fo", kFalloffNone);
+    eAttr.addField("none", kFalloffNone);
+    eAttr.addField("radius", kFalloffRadius);
+    eAttr.addField("ring", kFalloffRing);
+    eAttr.addField("geodesic", kFalloffGeodesic);
+    MAKE_INPUT(eAttr);
+    addAttribute(aFalloff);
+
+    aFalloffRadius = nAttr.create("falloffRadius", "for", MFnNumericData::kFloat, 1.0);
+    nAttr.setMin(0.0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aFalloffRadius);
+
+    aFalloffRings = nAttr.create("falloffRings", "frg", MFnNumericData::kInt, 2);
+    nAttr.setMin(0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aFalloffRings);
+
+    // geodesic distances follow the deformed mesh, refactored whenever the points move.
+    // off measures them on the points the topology was first seen with
+    aGeodesicDeform = nAttr.create("geodesicDeform", "gdf", MFnNumericData::kBoolean, 0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aGeodesicDeform);
+
+    // every crossing of the point/vector ray instead of the closest one
+    aMultiHit = nAttr.create("multiHit", "mh", MFnNumericData::kBoolean, 0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aMultiHit);
+
+    // batched rays, origins and directions are matched by logical index
+    aRayOrigin = nAttr.create("rayOrigin", "ro", MFnNumericData::k3Float);
+    MAKE_INPUT(nAttr);
+    nAttr.setArray(true);
+    addAttribute(aRayOrigin);
+
+    aRayDirection = nAttr.create("rayDirection", "rd", MFnNumericData::k3Float);
+    MAKE_INPUT(nAttr);
+    nAttr.setArray(true);
+    addAttribute(aRayDirection);
+
+    // closest point queries, matched to their outputs by logical index
+    aQueryPoint = nAttr.create("queryPoint", "qp", MFnNumericData::k3Float);
+    MAKE_INPUT(nAttr);
+    nAttr.setArray(true);
+    addAttribute(aQueryPoint);
+
+    aQueryMaxDistance = nAttr.create("queryMaxDistance", "qmd", MFnNumericData::kFloat, MAX_RAY_PARAM);
+    nAttr.setMin(0.0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aQueryMaxDistance);
+
+    // distance field for queryDistances, finest voxels that fit the budget
+    aSDFBrickSize = nAttr.create("sdfBrickSize", "sbs", MFnNumericData::kInt, 8);
+    nAttr.setMin(2);
+    nAttr.setMax(32);
+    MAKE_INPUT(nAttr);
+    addAttribute(aSDFBrickSize);
+
+    aSDFMemoryBudget = nAttr.create("sdfMemoryBudget", "smb", MFnNumericData::kFloat, 64.0);
+    nAttr.setMin(0.0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aSDFMemoryBudget);
+
+    // baked weights, a frame inside the bake is read back instead of traced
+    aTime = uAttr.create("time", "tm", MFnUnitAttribute::kTime, 0.0);
+    MAKE_INPUT(uAttr);
+    addAttribute(aTime);
+
+    aCacheFile = mAttr.create("cacheFile", "cf", MFnData::kString);
+    MAKE_INPUT(mAttr);
+    addAttribute(aCacheFile);
+
+    aUseCache = nAttr.create("useCache", "uc", MFnNumericData::kBoolean, 0);
+    MAKE_INPUT(nAttr);
+    addAttribute(aUseCache);
+
+    // uv image of the weights, square and only rasterized when uvWeights is requested
+    aUVResolution = nAttr.create("uvResolution", "uvr", MFnNumericData::kInt, 256);
+    nAttr.setMin(1);
+    nAttr.setMax(8192);
+    MAKE_INPUT(nAttr);
+    addAttribute(aUVResolution);
+
+    aUVFile = mAttr.create("uvFile", "uvf", MFnData::kString);
+    MAKE_INPUT(mAttr);
+    addAttribute(aUVFile);
+
     // output
     aOutput = nAttr.create("output", "o", MFnNumericData::kFloat);
     nAttr.setArray(true);
@@ -78,6 +277,79 @@ MStatus VertexNode::initialize()
     nAttr.setStorable(false);
     addAttribute(aOutput);
 
+    // same weights as output, as a single float array block
+    aOutputWeights = mAttr.create("outputWeights", "ow", MFnData::kFloatArray);
+    MAKE_OUTPUT(mAttr);
+    addAttribute(aOutputWeights);
+
+    // per vertex visibility of the point, only traced when this plug is requested
+    aVisibility = mAttr.create("visibility", "vis", MFnData::kFloatArray);
+    MAKE_OUTPUT(mAttr);
+    addAttribute(aVisibility);
+
+    aUVWeights = mAttr.create("uvWeights", "uvw", MFnData::kFloatArray);
+    MAKE_OUTPUT(mAttr);
+    addAttribute(aUVWeights);
+
+    // per ray hit triangle vertices and weights, -1 ids when the ray misses
+    aRayVertices = nAttr.create("rayVertices", "rv", MFnNumericData::k3Int);
+    MAKE_OUTPUT(nAttr);
+    nAttr.setArray(true);
+    nAttr.setUsesArrayDataBuilder(true);
+    addAttribute(aRayVertices);
+
+    aRayWeights = nAttr.create("rayWeights", "rw", MFnNumericData::k3Float);
+    MAKE_OUTPUT(nAttr);
+    nAttr.setArray(true);
+    nAttr.setUsesArrayDataBuilder(true);
+    addAttribute(aRayWeights);
+
+    // per query point closest triangle vertices and weights, -1 ids when none is in range
+    aQueryVertices = nAttr.create("queryVertices", "qv", MFnNumericData::k3Int);
+    MAKE_OUTPUT(nAttr);
+    nAttr.setArray(true);
+    nAttr.setUsesArrayDataBuilder(true);
+    addAttribute(aQueryVertices);
+
+    aQueryWeights = nAttr.create("queryWeights", "qw", MFnNumericData::k3Float);
+    MAKE_OUTPUT(nAttr);
+    nAttr.setArray(true);
+    nAttr.setUsesArrayDataBuilder(true);
+    addAttribute(aQueryWeights);
+
+    // signed distance per query point, only computed when this plug is requested
+    aQueryDistances = nAttr.create("queryDistances", "qd", MFnNumericData::kFloat);
+    MAKE_OUTPUT(nAttr);
+    nAttr.setArray(true);
+    nAttr.setUsesArrayDataBuilder(true);
+    addAttribute(aQueryDistances);
+
+    // point/vector ray hits sorted by distance, three vertex ids and weights per hit
+    aHitDistances = mAttr.create("hitDistances", "hd", MFnData::kFloatArray);
+    MAKE_OUTPUT(mAttr);
+    addAttribute(aHitDistances);
+
+    aHitVertices = mAttr.create("hitVertices", "hv", MFnData::kIntArray);
+    MAKE_OUTPUT(mAttr);
+    addAttribute(aHitVertices);
+
+    aHitWeights = mAttr.create("hitWeights", "hw", MFnData::kFloatArray);
+    MAKE_OUTPUT(mAttr);
+    addAttribute(aHitWeights);
+
+    // closest hit over inputMeshes, which mesh and where on it
+    aHitMesh = nAttr.create("hitMesh", "hm", MFnNumericData::kInt, -1);
+    MAKE_OUTPUT(nAttr);
+    addAttribute(aHitMesh);
+
+    aHitMeshVertices = nAttr.create("hitMeshVertices", "hmv", MFnNumericData::k3Int);
+    MAKE_OUTPUT(nAttr);
+    addAttribute(aHitMeshVertices);
+
+    aHitMeshWeights = nAttr.create("hitMeshWeights", "hmw", MFnNumericData::k3Float);
+    MAKE_OUTPUT(nAttr);
+    addAttribute(aHitMeshWeights);
+
     // attribute affects
     CHECK_MSTATUS(attributeAffects(aInputMesh, aOutput));
     CHECK_MSTATUS(attributeAffects(aPointX, aOutput));
@@ -88,6 +360,103 @@ MStatus VertexNode::initialize()
     CHECK_MSTATUS(attributeAffects(aVectorY, aOutput));
     CHECK_MSTATUS(attributeAffects(aVectorZ, aOutput));
     CHECK_MSTATUS(attributeAffects(aVector, aOutput));
+    CHECK_MSTATUS(attributeAffects(aRayOrigin, aOutput));
+    CHECK_MSTATUS(attributeAffects(aRayDirection, aOutput));
+    CHECK_MSTATUS(attributeAffects(aSparseOutput, aOutput));
+    CHECK_MSTATUS(attributeAffects(aFalloff, aOutput));
+    CHECK_MSTATUS(attributeAffects(aFalloffRadius, aOutput));
+    CHECK_MSTATUS(attributeAffects(aFalloffRings, aOutput));
+    CHECK_MSTATUS(attributeAffects(aGeodesicDeform, aOutput));
+    CHECK_MSTATUS(attributeAffects(aMultiHit, aOutput));
+    CHECK_MSTATUS(attributeAffects(aHitCache, aOutput));
+    CHECK_MSTATUS(attributeAffects(aQueryPoint, aOutput));
+    CHECK_MSTATUS(attributeAffects(aConeAngle, aOutput));
+    CHECK_MSTATUS(attributeAffects(aConeSamples, aOutput));
+    CHECK_MSTATUS(attributeAffects(aTime, aOutput));
+    CHECK_MSTATUS(attributeAffects(aCacheFile, aOutput));
+    CHECK_MSTATUS(attributeAffects(aUseCache, aOutput));
+    CHECK_MSTATUS(attributeAffects(aQueryMaxDistance, aOutput));
+
+    CHECK_MSTATUS(attributeAffects(aInputMesh, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aPoint, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aVector, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aRayOrigin, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aRayDirection, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aFalloff, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aFalloffRadius, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aFalloffRings, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aGeodesicDeform, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aMultiHit, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aHitCache, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aQueryPoint, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aConeAngle, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aConeSamples, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aTime, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aCacheFile, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aUseCache, aOutputWeights));
+    CHECK_MSTATUS(attributeAffects(aQueryMaxDistance, aOutputWeights));
+
+    // the uv image follows every input of the weights
+    const MObject weight_inputs[] = { aInputMesh, aPoint, aVector, aRayOrigin, aRayDirection,
+        aFalloff, aFalloffRadius, aFalloffRings, aGeodesicDeform, aMultiHit, aHitCache, aQueryPoint,
+        aConeAngle, aConeSamples, aQueryMaxDistance, aUVResolution, aUVFile };
+    for (const MObject& weight_input : weight_inputs)
+    {
+        CHECK_MSTATUS(attributeAffects(weight_input, aUVWeights));
+    }
+
+    CHECK_MSTATUS(attributeAffects(aInputMesh, aVisibility));
+    CHECK_MSTATUS(attributeAffects(aPointX, aVisibility));
+    CHECK_MSTATUS(attributeAffects(aPointY, aVisibility));
+    CHECK_MSTATUS(attributeAffects(aPointZ, aVisibility));
+    CHECK_MSTATUS(attributeAffects(aPoint, aVisibility));
+
+    CHECK_MSTATUS(attributeAffects(aInputMesh, aRayVertices));
+    CHECK_MSTATUS(attributeAffects(aRayOrigin, aRayVertices));
+    CHECK_MSTATUS(attributeAffects(aRayDirection, aRayVertices));
+    CHECK_MSTATUS(attributeAffects(aHitCache, aRayVertices));
+    CHECK_MSTATUS(attributeAffects(aInputMesh, aRayWeights));
+    CHECK_MSTATUS(attributeAffects(aRayOrigin, aRayWeights));
+    CHECK_MSTATUS(attributeAffects(aRayDirection, aRayWeights));
+    CHECK_MSTATUS(attributeAffects(aHitCache, aRayWeights));
+
+    CHECK_MSTATUS(attributeAffects(aInputMesh, aQueryVertices));
+    CHECK_MSTATUS(attributeAffects(aQueryPoint, aQueryVertices));
+    CHECK_MSTATUS(attributeAffects(aQueryMaxDistance, aQueryVertices));
+    CHECK_MSTATUS(attributeAffects(aInputMesh, aQueryWeights));
+    CHECK_MSTATUS(attributeAffects(aQueryPoint, aQueryWeights));
+    CHECK_MSTATUS(attributeAffects(aQueryMaxDistance, aQueryWeights));
+
+    CHECK_MSTATUS(attributeAffects(aInputMesh, aQueryDistances));
+    CHECK_MSTATUS(attributeAffects(aQueryPoint, aQueryDistances));
+    CHECK_MSTATUS(attributeAffects(aQueryMaxDistance, aQueryDistances));
+    CHECK_MSTATUS(attributeAffects(aSDFBrickSize, aQueryDistances));
+    CHECK_MSTATUS(attributeAffects(aSDFMemoryBudget, aQueryDistances));
+
+    const MObject hit_outputs[] = { aHitDistances, aHitVertices, aHitWeights };
+    for (const MObject& hit_output : hit_outputs)
+    {
+        CHECK_MSTATUS(attributeAffects(aInputMesh, hit_output));
+        CHECK_MSTATUS(attributeAffects(aPoint, hit_output));
+        CHECK_MSTATUS(attributeAffects(aVector, hit_output));
+        CHECK_MSTATUS(attributeAffects(aMultiHit, hit_output));
+        CHECK_MSTATUS(attributeAffects(aHitCache, hit_output));
+        CHECK_MSTATUS(attributeAffects(aConeAngle, hit_output));
+    }
+
+    const MObject scene_outputs[] = { aHitMesh, aHitMeshVertices, aHitMeshWeights };
+    for (const MObject& scene_output : scene_outputs)
+    {
+        CHECK_MSTATUS(attributeAffects(aInputMeshes, scene_output));
+        CHECK_MSTATUS(attributeAffects(aPoint, scene_output));
+        CHECK_MSTATUS(attributeAffects(aPointX, scene_output));
+        CHECK_MSTATUS(attributeAffects(aPointY, scene_output));
+        CHECK_MSTATUS(attributeAffects(aPointZ, scene_output));
+        CHECK_MSTATUS(attributeAffects(aVector, scene_output));
+        CHECK_MSTATUS(attributeAffects(aVectorX, scene_output));
+        CHECK_MSTATUS(attributeAffects(aVectorY, scene_output));
+        CHECK_MSTATUS(attributeAffects(aVectorZ, scene_output));
+    }
 
     return MS::kSuccess;
 }
@@ -96,7 +465,10 @@ MStatus VertexNode::setDependentsDirty(const MPlug& plug, MPlugArray& affectedPl
 {
     if (plug == aPoint || plug == aPointX || plug == aPointY || plug == aPointZ ||
         plug == aVector || plug == aVectorX || plug == aVectorY || plug == aVectorZ ||
-        plug == aInputMesh) _dirty = true;
+        plug == aRayOrigin || plug == aRayDirection || plug == aInputMesh ||
+        plug == aMultiHit || plug == aHitCache || plug == aQueryPoint ||
+        plug == aConeAngle || plug == aConeSamples || plug == aInputMeshes) _dirty = true;
+    if (plug == aInputMesh) _mesh_dirty = true;
 
     return MPxNode::setDependentsDirty(plug, affectedPlugs);
 }
@@ -110,7 +482,10 @@ MStatus VertexNode::preEvaluation(const MDGContext& context, const MEvaluationNo
         return MS::kFailure;
     }
 
-    if ((evaluationNode.dirtyPlugExists(aInputMesh, &status) && status) ||
+    const bool mesh_dirty = evaluationNode.dirtyPlugExists(aInputMesh, &status) && status;
+    if (mesh_dirty) _mesh_dirty = true;
+
+    if (mesh_dirty ||
         (evaluationNode.dirtyPlugExists(aPoint, &status) && status)     ||
         (evaluationNode.dirtyPlugExists(aPointX, &status) && status)    ||
         (evaluationNode.dirtyPlugExists(aPointY, &status) && status)    ||
@@ -118,14 +493,25 @@ MStatus VertexNode::preEvaluation(const MDGContext& context, const MEvaluationNo
         (evaluationNode.dirtyPlugExists(aVector, &status) && status)    ||
         (evaluationNode.dirtyPlugExists(aVectorX, &status) && status)   ||
         (evaluationNode.dirtyPlugExists(aVectorY, &status) && status)   ||
-        (evaluationNode.dirtyPlugExists(aVectorZ, &status) && status)) _dirty = true;
+        (evaluationNode.dirtyPlugExists(aVectorZ, &status) && status)   ||
+        (evaluationNode.dirtyPlugExists(aRayOrigin, &status) && status) ||
+        (evaluationNode.dirtyPlugExists(aRayDirection, &status) && status) ||
+        (evaluationNode.dirtyPlugExists(aMultiHit, &status) && status)  ||
+        (evaluationNode.dirtyPlugExists(aHitCache, &status) && status)  ||
+        (evaluationNode.dirtyPlugExists(aQueryPoint, &status) && status) ||
+        (evaluationNode.dirtyPlugExists(aConeAngle, &status) && status)  ||
+        (evaluationNode.dirtyPlugExists(aConeSamples, &status) && status) ||
+        (evaluationNode.dirtyPlugExists(aInputMeshes, &status) && status)) _dirty = true;
 
     return MS::kSuccess;
 }
 
 bool VertexNode::isPassiveOutput(const MPlug& plug) const
 {
-    if (plug == aOutput)
+    if (plug == aOutput || plug == aOutputWeights || plug == aRayVertices || plug == aRayWeights ||
+        plug == aVisibility || plug == aHitDistances || plug == aHitVertices || plug == aHitWeights ||
+        plug == aQueryVertices || plug == aQueryWeights || plug == aUVWeights || plug == aQueryDistances ||
+        plug == aHitMesh || plug == aHitMeshVertices || plug == aHitMeshWeights)
     {
         return true;
     }
@@ -136,11 +522,28 @@ bool VertexNode::isPassiveOutput(const MPlug& plug) const
 MStatus VertexNode::compute(const MPlug& plug, MDataBlock& data)
 {
     MStatus status = MS::kUnknownParameter;
-    if (plug != aOutput)
+    if (plug != aOutput && plug != aOutputWeights && plug != aRayVertices && plug != aRayWeights &&
+        plug != aVisibility && plug != aHitDistances && plug != aHitVertices && plug != aHitWeights &&
+        plug != aQueryVertices && plug != aQueryWeights && plug != aUVWeights && plug != aQueryDistances &&
+        plug != aHitMesh && plug != aHitMeshVertices && plug != aHitMeshWeights)
     {
         return  status;
     }
 
+    // the scene hit only reads inputMeshes, inputMesh may be left unconnected
+    if (plug == aHitMesh || plug == aHitMeshVertices || plug == aHitMeshWeights)
+    {
+        status = updateScene(data);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        return writeSceneHit(data, data.inputValue(aPoint).asFloat3(), data.inputValue(aVector).asFloat3());
+    }
+
+    // a baked frame needs neither the mesh nor any ray
+    if ((plug == aOutput || plug == aOutputWeights) && readCachedWeights(plug, data))
+    {
+        return MS::kSuccess;
+    }
+
     // get inputs
     const MDataHandle& mesh_handle = data.inputValue(aInputMesh);
     if (mesh_handle.type() != MFnData::kMesh)
@@ -155,173 +558,1460 @@ MStatus VertexNode::compute(const MPlug& plug, MDataBlock& data)
     const float3& position = data.inputValue(aPoint).asFloat3();
     const float3& vector = data.inputValue(aVector).asFloat3();
 
-    MArrayDataHandle output_array = data.outputArrayValue(aOutput);
-    MArrayDataBuilder output_builder = output_array.builder(&status);
-    CHECK_MSTATUS(status);
+    unsigned int num_verts = fnMesh.numVertices();
 
-    MFloatPoint ray_position(position[0], position[1], position[2]);
-    MFloatVector ray_direction(vector[0], vector[1], vector[2]);
+    status = updateAccelerator(fnMesh);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
 
-    // output array builder
-    unsigned int num_verts = fnMesh.numVertices();
+    // visibility only depends on the mesh and the point, none of the ray work below
+    if (plug == aVisibility)
+    {
+        return writeVisibility(data, position);
+    }
 
-    for (unsigned int i = 0; i < num_verts; ++i)
-    {
-        MDataHandle outHandle = output_builder.addElement(i);
-        outHandle.set(0.f);
-    }
-
-    MIntArray faceIds;
-    MIntArray triIds;
-    MMeshIsectAccelParams mmAccelParams = fnMesh.autoUniformGridParams();
-    MFloatPoint hitPoint;
-    float hitRayParam;
-    int hitFace, hitTriangle;
-    float bary1, bary2;
-
-    bool intersects = fnMesh.closestIntersection(
-        ray_position, 
-        ray_direction, 
-        nullptr, 
-        nullptr,
-        true, 
-        MSpace::kWorld,
-        99.f,
-        false,
-        &mmAccelParams,
-        hitPoint,
-        &hitRayParam,
-        &hitFace,
-        &hitTriangle,
-        &bary1,
-        &bary2,
-        1e-6,
-        &status);
-
-    if (intersects)
-    {
-        // get vertex ids
-        int3 vertex_id;
-        fnMesh.getPolygonTriangleVertices(hitFace, hitTriangle, vertex_id);
-
-        // get points position
-        MPoint point1;
-        fnMesh.getPoint(vertex_id[0], point1, MSpace::kWorld);
-        MPoint point2;
-        fnMesh.getPoint(vertex_id[1], point2, MSpace::kWorld);
-        MPoint point3;
-        fnMesh.getPoint(vertex_id[2], point3, MSpace::kWorld);
-
-        float3 float_point1{ point1.x, point1.y, point1.z };
-        float3 float_point2{ point2.x, point2.y, point2.z };
-        float3 float_point3{ point3.x, point3.y, point3.z };
-        float3 float_point{ (float)hitPoint.x, (float)hitPoint.y, (float)hitPoint.z };
-
-        float* vector_weight = get_vertex_weight(
-        float_point1,
-        float_point2,
-        float_point3,
-        float_point);
+    // distances only need the query points, the field is built on the first request
+    if (plug == aQueryDistances)
+    {
+        return writeQueryDistances(data);
+    }
 
-        for (unsigned int i = 0; i < 3; i++)
+    std::vector<unsigned int> ray_indices;
+    std::vector<float> rays;
+    read_batch_rays(data, ray_indices, rays);
+
+    std::vector<unsigned int> query_indices;
+    std::vector<float> query_points;
+    read_query_points(data, query_indices, query_points);
+    const float query_max_distance = data.inputValue(aQueryMaxDistance).asFloat();
+
+    auto query_start = std::chrono::high_resolution_clock::now();
+
+    // batched rays keep their cache slot while the ray count stays the same
+    const int num_rays = (int)ray_indices.size();
+    const bool hit_cache = data.inputValue(aHitCache).asBool();
+    if (hit_cache)
+    {
+        if (_vertex_triangle_offsets.empty()) updateVertexTriangles();
+        if (_hit_cache.size() != (size_t)num_rays + 1) _hit_cache.assign(num_rays + 1, -1);
+    }
+    else
+    {
+        _hit_cache.clear();
+    }
+
+    // the cached triangle and its neighbours first, the full bvh query on a miss.
+    // counters are summed per chunk so workers do not share a cache line per ray
+    std::atomic<unsigned long long> cache_queries(0);
+    std::atomic<unsigned long long> cache_hits(0);
+    auto intersect = [&](int slot, const float* origin, const float* direction, RayHit& ray_hit,
+        unsigned long long& queries, unsigned long long& cached_hits) {
+        if (!hit_cache) return _bvh.intersect(origin, direction, MAX_RAY_PARAM, ray_hit);
+
+        const int cached = _hit_cache[slot];
+        if (cached >= 0)
         {
-            MDataHandle data_handle = output_builder.addElement(vertex_id[i]);
-            data_handle.set(vector_weight[i]);
+            queries++;
+            if (intersectNearTriangle(cached, origin, direction, ray_hit))
+            {
+                cached_hits++;
+                _hit_cache[slot] = ray_hit.triangle;
+                return true;
+            }
         }
+
+        const bool found = _bvh.intersect(origin, direction, MAX_RAY_PARAM, ray_hit);
+        _hit_cache[slot] = found ? ray_hit.triangle : -1;
+        return found;
+    };
+
+    const float cone_angle = data.inputValue(aConeAngle).asFloat();
+    const int cone_samples = data.inputValue(aConeSamples).asInt();
+    const bool cone = cone_angle > 0.f && cone_samples > 0;
+
+    // multi hit gathers every crossing in the same single traversal, sorted by t
+    std::vector<RayHit> hits;
+    if (cone)
+    {
+        // traced below with the cone rays
+    }
+    else if (data.inputValue(aMultiHit).asBool())
+    {
+        _bvh.intersectAll(position, vector, MAX_RAY_PARAM, hits);
+        merge_coincident_hits(hits);
     }
     else
     {
-        //MGlobal::displayInfo("No intersection found\n");
+        RayHit hit;
+        unsigned long long queries = 0, cached_hits = 0;
+        if (intersect(0, position, vector, hit, queries, cached_hits)) hits.push_back(hit);
+        cache_queries += queries;
+        cache_hits += cached_hits;
     }
 
-    output_array.set(output_builder);
+    // batched rays share the same bvh, traced across worker threads
+    std::vector<int> ray_vertices(3 * num_rays, -1);
+    std::vector<float> ray_weights(3 * num_rays, 0.f);
+    std::vector<float> ray_points(3 * num_rays, 0.f);
+    parallel_for(0, num_rays, RAY_GRAIN_SIZE, [&](int begin, int end) {
+        unsigned long long queries = 0, cached_hits = 0;
+        for (int r = begin; r < end; ++r)
+        {
+            const float* origin = &rays[6 * r];
+            const float* direction = &rays[6 * r + 3];
 
-    output_array.setAllClean();
-    return MS::kSuccess;
-}
+            RayHit ray_hit;
+            if (!intersect(r + 1, origin, direction, ray_hit, queries, cached_hits)) continue;
 
+            const int* ids = _bvh.triangleVertices(ray_hit.triangle);
+            const float hit_point[3] = {
+                origin[0] + ray_hit.t * direction[0],
+                origin[1] + ray_hit.t * direction[1],
+                origin[2] + ray_hit.t * direction[2] };
 
-static float* get_vertex_weight(
-    const float3& vertex1, const float3& vertex2, const float3& vertex3, const float3& point)
-{
-    // barycentric coordinates to extract the area of the inverse try
-    float area_v1, area_v2, area_v3;
+            VertexWeights vector_weight = get_vertex_weight(
+                &_points[3 * ids[0]],
+                &_points[3 * ids[1]],
+                &_points[3 * ids[2]],
+                hit_point);
 
-    const float* vertex_array[3]{ vertex1, vertex2, vertex3 };
+            ray_points[3 * r] = hit_point[0];
+            ray_points[3 * r + 1] = hit_point[1];
+            ray_points[3 * r + 2] = hit_point[2];
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                ray_vertices[3 * r + i] = ids[i];
+                ray_weights[3 * r + i] = vector_weight.w[i];
+            }
+        }
+        cache_queries += queries;
+        cache_hits += cached_hits;
+    });
 
-    float3 vertex_areas;
+    // cone rays, every chunk collects its hits in its own buffer so workers never share
+    // an accumulator, buffers are merged in chunk order to keep the sum order fixed
+    const int num_cone_chunks = cone ? (cone_samples + CONE_GRAIN_SIZE - 1) / CONE_GRAIN_SIZE : 0;
+    std::vector<std::vector<std::pair<int, float>>> cone_contributions(num_cone_chunks);
+    std::vector<std::vector<float>> cone_points(num_cone_chunks);
+    parallel_for(0, cone ? cone_samples : 0, CONE_GRAIN_SIZE, [&](int begin, int end) {
+        std::vector<std::pair<int, float>>& chunk_contributions = cone_contributions[begin / CONE_GRAIN_SIZE];
+        std::vector<float>& chunk_points = cone_points[begin / CONE_GRAIN_SIZE];
 
-    for (unsigned int i = 0; i < 3; ++i)
+        // a fully hit cone sums to the weight of one ray
+        const float sample_weight = 1.f / cone_samples;
+        for (int sample = begin; sample < end; ++sample)
+        {
+            float direction[3];
+            cone_direction(vector, cone_angle, sample, cone_samples, direction);
+
+            RayHit ray_hit;
+            if (!_bvh.intersect(position, direction, MAX_RAY_PARAM, ray_hit)) continue;
+
+            const int* ids = _bvh.triangleVertices(ray_hit.triangle);
+            const float weights[3] = { 1.f - ray_hit.u - ray_hit.v, ray_hit.u, ray_hit.v };
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                chunk_contributions.push_back(std::make_pair(ids[i], weights[i] * sample_weight));
+            }
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                chunk_points.push_back(position[k] + ray_hit.t * direction[k]);
+            }
+        }
+    });
+
+    // closest point queries, the weights come straight from the closest point barycentrics
+    const int num_queries = (int)query_indices.size();
+    std::vector<int> query_vertices(3 * num_queries, -1);
+    std::vector<float> query_weights(3 * num_queries, 0.f);
+    std::vector<float> query_closest(3 * num_queries, 0.f);
+    parallel_for(0, num_queries, QUERY_GRAIN_SIZE, [&](int begin, int end) {
+        for (int q = begin; q < end; ++q)
+        {
+            PointHit point_hit;
+            if (!_bvh.closestPoint(&query_points[3 * q], query_max_distance, point_hit)) continue;
+
+            const int* ids = _bvh.triangleVertices(point_hit.triangle);
+            const float weights[3] = { 1.f - point_hit.u - point_hit.v, point_hit.u, point_hit.v };
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                query_vertices[3 * q + i] = ids[i];
+                query_weights[3 * q + i] = weights[i];
+            }
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                query_closest[3 * q + k] = weights[0] * _points[3 * ids[0] + k] +
+                    weights[1] * _points[3 * ids[1] + k] + weights[2] * _points[3 * ids[2] + k];
+            }
+        }
+    });
+
+    _query_time = elapsed_ms(query_start);
+    _cache_queries += cache_queries;
+    _cache_hits += cache_hits;
+
+    // (vertex, weight) pairs of every hit, summed per vertex on output
+    std::vector<std::pair<int, float>> contributions;
+    std::vector<float> hit_points;  // xyz of every hit, single ray first
+
+    MFloatArray hit_distances(hits.size());
+    MIntArray hit_vertex_ids(3 * (unsigned int)hits.size());
+    MFloatArray hit_weights(3 * (unsigned int)hits.size());
+
+    for (unsigned int h = 0; h < hits.size(); h++)
     {
-        float3 v0 = {
-            vertex_array[(i + 1) % 3][0] - vertex_array[i][0],
-            vertex_array[(i + 1) % 3][1] - vertex_array[i][1],
-            vertex_array[(i + 1) % 3][2] - vertex_array[i][2],
-        };
+        // vertex ids and positions straight from the triangle table and the points copy
+        const RayHit& hit = hits[h];
+        const int* vertex_id = _bvh.triangleVertices(hit.triangle);
+        const float hit_point[3] = {
+            position[0] + hit.t * vector[0],
+            position[1] + hit.t * vector[1],
+            position[2] + hit.t * vector[2] };
+        hit_points.insert(hit_points.end(), hit_point, hit_point + 3);
+
+        VertexWeights vector_weight = get_vertex_weight(
+            &_points[3 * vertex_id[0]],
+            &_points[3 * vertex_id[1]],
+            &_points[3 * vertex_id[2]],
+            hit_point);
 
-        float3 v1 = {
-            vertex_array[(i + 2) % 3][0] - vertex_array[i][0],
-            vertex_array[(i + 2) % 3][1] - vertex_array[i][1],
-            vertex_array[(i + 2) % 3][2] - vertex_array[i][2],
-        };
+        hit_distances[h] = hit.t;
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            contributions.push_back(std::make_pair(vertex_id[i], vector_weight.w[i]));
+            hit_vertex_ids[3 * h + i] = vertex_id[i];
+            hit_weights[3 * h + i] = vector_weight.w[i];
+        }
+    }
 
-        float3 v2 = {
-            point[0] - vertex_array[i][0],
-            point[1] - vertex_array[i][1],
-            point[2] - vertex_array[i][2]
-        };
+    for (int chunk = 0; chunk < num_cone_chunks; ++chunk)
+    {
+        contributions.insert(contributions.end(),
+            cone_contributions[chunk].begin(), cone_contributions[chunk].end());
+        hit_points.insert(hit_points.end(), cone_points[chunk].begin(), cone_points[chunk].end());
+    }
+
+    MArrayDataBuilder ray_vertices_builder(&data, aRayVertices, num_rays, &status);
+    CHECK_MSTATUS(status);
+    MArrayDataBuilder ray_weights_builder(&data, aRayWeights, num_rays, &status);
+    CHECK_MSTATUS(status);
 
-        float dot00 = dot(v0, v0);
-        float dot01 = dot(v0, v1);
-        float dot02 = dot(v0, v2);
-        float dot11 = dot(v1, v1);
-        float dot12 = dot(v1, v2);
+    for (int r = 0; r < num_rays; ++r)
+    {
+        const int* vertex_id = &ray_vertices[3 * r];
+        const float* weights = &ray_weights[3 * r];
 
-        // calc barycentric
-        float inv_denom = 1 / (dot00 * dot11 - dot01 * dot01);
-        float u = 1 - ((dot11 * dot02 - dot01 * dot12) * inv_denom);
-        float v = 1 - ((dot00 * dot12 - dot01 * dot02) * inv_denom);
+        if (vertex_id[0] >= 0)
+        {
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                contributions.push_back(std::make_pair(vertex_id[i], weights[i]));
+            }
+            hit_points.insert(hit_points.end(), &ray_points[3 * r], &ray_points[3 * r] + 3);
+        }
 
-        std::cout << u << ", " << v << std::endl;
-        vertex_areas[i] = vector_magnitude(cross_product(
-            float3{ v0[0] * u, v0[1] * u, v0[2] * u },
-            float3{ v1[0] * v, v1[1] * v, v1[2] * v }));
+        ray_vertices_builder.addElement(ray_indices[r]).set3Int(
+            vertex_id[0], vertex_id[1], vertex_id[2]);
+        ray_weights_builder.addElement(ray_indices[r]).set3Float(
+            weights[0], weights[1], weights[2]);
     }
 
-    float total_area = vertex_areas[0] + vertex_areas[1] + vertex_areas[2];
+    MArrayDataBuilder query_vertices_builder(&data, aQueryVertices, num_queries, &status);
+    CHECK_MSTATUS(status);
+    MArrayDataBuilder query_weights_builder(&data, aQueryWeights, num_queries, &status);
+    CHECK_MSTATUS(status);
 
-    static float3 vertex_weight;
-    for (unsigned int i = 0; i < 3; ++i)
+    for (int q = 0; q < num_queries; ++q)
     {
-        // normalize areas and get inverse
-        vertex_weight[i] = vertex_areas[i] / total_area;
+        const int* vertex_id = &query_vertices[3 * q];
+        const float* weights = &query_weights[3 * q];
+
+        // closest points drive the outputs like ray hits do
+        if (vertex_id[0] >= 0)
+        {
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                contributions.push_back(std::make_pair(vertex_id[i], weights[i]));
+            }
+            hit_points.insert(hit_points.end(), &query_closest[3 * q], &query_closest[3 * q] + 3);
+        }
+
+        query_vertices_builder.addElement(query_indices[q]).set3Int(
+            vertex_id[0], vertex_id[1], vertex_id[2]);
+        query_weights_builder.addElement(query_indices[q]).set3Float(
+            weights[0], weights[1], weights[2]);
     }
 
-    std::cout << vertex_weight[0] + vertex_weight[1] + vertex_weight[2] << std::endl;
+    // soft brush, every vertex around a hit point gets a falloff weight instead
+    const short falloff = data.inputValue(aFalloff).asShort();
+    const float falloff_radius = data.inputValue(aFalloffRadius).asFloat();
+    if (falloff == kFalloffRadius && falloff_radius > 0.f)
+    {
+        updateGrid(falloff_radius);
 
-    return vertex_weight;
-}
+        contributions.clear();
+        for (size_t h = 0; h < hit_points.size(); h += 3)
+        {
+            _grid.query(_points.data(), &hit_points[h], falloff_radius, _grid_scratch,
+                [&](int vertex, float distance2) {
+                    contributions.push_back(std::make_pair(vertex,
+                        falloff_weight(sqrtf(distance2), falloff_radius)));
+                });
+        }
+    }
+    else if (falloff == kFalloffRing)
+    {
+        status = updateAdjacency(fnMesh);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+
+        // every hit pushed its three triangle vertices, those seed the rings
+        const int rings = data.inputValue(aFalloffRings).asInt();
+        std::vector<std::pair<int, float>> hit_vertices;
+        hit_vertices.swap(contributions);
+        for (size_t h = 0; h + 2 < hit_vertices.size(); h += 3)
+        {
+            addRingWeights(&hit_vertices[h], rings, contributions);
+        }
+    }
+    else if (falloff == kFalloffGeodesic && falloff_radius > 0.f)
+    {
+        updateGeodesic(data.inputValue(aGeodesicDeform).asBool());
+
+        // heat starts from the hit triangle vertices, spread by their barycentric weights.
+        // hits solve in parallel, each chunk with the scratch it kept from the last compute
+        // and its own contribution buffer, merged in chunk order
+        std::vector<std::pair<int, float>> hit_vertices;
+        hit_vertices.swap(contributions);
+        const int num_hits = (int)hit_vertices.size() / 3;
+        const int grain = std::max(GEODESIC_GRAIN_SIZE,
+            (num_hits + GEODESIC_MAX_CHUNKS - 1) / GEODESIC_MAX_CHUNKS);
+        const int num_chunks = (num_hits + grain - 1) / grain;
+        if ((int)_geodesic_scratch.size() < num_chunks) _geodesic_scratch.resize(num_chunks);
+        std::vector<std::vector<std::pair<int, float>>> geodesic_contributions(num_chunks);
+
+        parallel_for(0, num_hits, grain, [&](int begin, int end) {
+            HeatGeodesic::Scratch& scratch = _geodesic_scratch[begin / grain];
+            std::vector<std::pair<int, float>>& chunk_contributions = geodesic_contributions[begin / grain];
+            std::vector<float>& distances = scratch.distances;
+            for (int hit = begin; hit < end; ++hit)
+            {
+                int sources[3];
+                float source_weights[3];
+                for (unsigned int i = 0; i < 3; ++i)
+                {
+                    sources[i] = hit_vertices[3 * hit + i].first;
+                    source_weights[i] = std::max(0.f, hit_vertices[3 * hit + i].second);
+                }
+
+                _geodesic.distance(sources, source_weights, 3, distances, scratch);
+                for (size_t v = 0; v < distances.size(); ++v)
+                {
+                    if (distances[v] < falloff_radius)
+                    {
+                        chunk_contributions.push_back(std::make_pair((int)v,
+                            falloff_weight(distances[v], falloff_radius)));
+                    }
+                }
+            }
+        });
+
+        for (const auto& chunk_contributions : geodesic_contributions)
+        {
+            contributions.insert(contributions.end(), chunk_contributions.begin(), chunk_contributions.end());
+        }
+    }
+
+    // accumulate the weights of every ray, one (vertex, weight) pair per vertex
+    std::sort(contributions.begin(), contributions.end());
+    size_t num_weights = 0;
+    for (size_t i = 0; i < contributions.size();)
+    {
+        const int vertex = contributions[i].first;
+        float weight = 0.f;
+        for (; i < contributions.size() && contributions[i].first == vertex; ++i)
+        {
+            weight += contributions[i].second;
+        }
+        contributions[num_weights++] = std::make_pair(vertex, weight);
+    }
+    contributions.resize(num_weights);
+
+    // only the requested weight output is filled, the other one stays dirty
+    if (plug == aOutput)
+    {
+        status = writeArrayOutput(data, num_verts, contributions);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
+    else if (plug == aOutputWeights)
+    {
+        status = writeDenseOutput(data, num_verts, contributions);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
+    else if (plug == aUVWeights)
+    {
+        status = writeUVWeights(data, fnMesh, num_verts, contributions);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
+
+    MArrayDataHandle ray_vertices_array = data.outputArrayValue(aRayVertices);
+    ray_vertices_array.set(ray_vertices_builder);
+    ray_vertices_array.setAllClean();
+
+    MArrayDataHandle ray_weights_array = data.outputArrayValue(aRayWeights);
+    ray_weights_array.set(ray_weights_builder);
+    ray_weights_array.setAllClean();
+
+    MArrayDataHandle query_vertices_array = data.outputArrayValue(aQueryVertices);
+    query_vertices_array.set(query_vertices_builder);
+    query_vertices_array.setAllClean();
+
+    MArrayDataHandle query_weights_array = data.outputArrayValue(aQueryWeights);
+    query_weights_array.set(query_weights_builder);
+    query_weights_array.setAllClean();
+
+    // per hit data of the point/vector ray, the summed weights went to output above
+    MFnFloatArrayData distances_data;
+    MDataHandle distances_handle = data.outputValue(aHitDistances);
+    distances_handle.set(distances_data.create(hit_distances, &status));
+    CHECK_MSTATUS(status);
+    distances_handle.setClean();
 
+    MFnIntArrayData hit_vertices_data;
+    MDataHandle hit_vertices_handle = data.outputValue(aHitVertices);
+    hit_vertices_handle.set(hit_vertices_data.create(hit_vertex_ids, &status));
+    CHECK_MSTATUS(status);
+    hit_vertices_handle.setClean();
+
+    MFnFloatArrayData hit_weights_data;
+    MDataHandle hit_weights_handle = data.outputValue(aHitWeights);
+    hit_weights_handle.set(hit_weights_data.create(hit_weights, &status));
+    CHECK_MSTATUS(status);
+    hit_weights_handle.setClean();
+
+    if (data.inputValue(aProfile).asBool())
+    {
+        MString info("vertexNode timings (ms), build: ");
+        info += _build_time;
+        info += ", refit: ";
+        info += _refit_time;
+        info += ", query: ";
+        info += _query_time;
+        info += ", kernel: ";
+        info += intersect_packet_isa();
+        if (hit_cache)
+        {
+            // running totals since the last topology change
+            info += ", cache hits: ";
+            info += (unsigned int)_cache_hits;
+            info += "/";
+            info += (unsigned int)_cache_queries;
+            info += " (";
+            info += _cache_queries ? 100.0 * _cache_hits / _cache_queries : 0.0;
+            info += "%)";
+        }
+        MGlobal::displayInfo(info);
+    }
 
-static float dot(const float3 vector1, const float3 vector2)
+    return MS::kSuccess;
+}
+
+bool VertexNode::readCachedWeights(const MPlug& plug, MDataBlock& data)
 {
-    return vector1[0] * vector2[0] + vector1[1] * vector2[1] + vector1[2] * vector2[2];
+    if (_cache_bypass || !data.inputValue(aUseCache).asBool()) return false;
+
+    const std::string path = data.inputValue(aCacheFile).asString().asChar();
+    if (path != _cache_path)
+    {
+        _cache_path = path;
+        if (path.empty() || !_cache.open(path))
+        {
+            _cache.close();
+            if (!path.empty()) MGlobal::displayWarning(MString("vertexNode: cannot read weight cache ") + path.c_str());
+            return false;
+        }
+    }
+    if (!_cache.isOpen()) return false;
+
+    // settings changed since the bake
+    if (_cache.settingsHash() != settings_hash(data)) return false;
+
+    // only whole frames were baked, subframes of motion blur are computed live
+    const double frame_time = data.inputValue(aTime).asTime().as(MTime::uiUnit());
+    const double frame = floor(frame_time + 0.5);
+    if (fabs(frame_time - frame) > CACHE_FRAME_EPSILON) return false;
+
+    const WeightCacheEntry* entries = nullptr;
+    int count = 0;
+    unsigned long long baked_stamp = 0;
+    if (!_cache.frame((int)frame, entries, count, baked_stamp)) return false;
+
+    // the mesh is read again only once it was dirtied. the topology is the one hashed by
+    // the last live compute, a mesh whose counts moved away from it goes live and is
+    // hashed again, a reconnection to another mesh of the same counts is not seen
+    if (_mesh_dirty)
+    {
+        const MDataHandle& mesh_handle = data.inputValue(aInputMesh);
+        if (mesh_handle.type() != MFnData::kMesh) return false;
+
+        MStatus status;
+        MFnMesh fnMesh(mesh_handle.asMesh());
+        const int num_verts = fnMesh.numVertices();
+        if (num_verts != _topology_counts[0] || fnMesh.numPolygons() != _topology_counts[1] ||
+            fnMesh.numFaceVertices() != _topology_counts[2]) return false;
+
+        const float* points = num_verts ? fnMesh.getRawPoints(&status) : nullptr;
+        if (!status) return false;
+        _points_stamp = points_stamp(points, (unsigned int)num_verts);
+        _mesh_dirty = false;
+    }
+    if (_topology_hash != _cache.topologyHash() || _topology_counts[0] != _cache.numVertices()) return false;
+
+    // animated point, vector, rays and query points against the bake
+    std::vector<unsigned int> ray_indices;
+    std::vector<float> rays;
+    read_batch_rays(data, ray_indices, rays);
+    std::vector<unsigned int> query_indices;
+    std::vector<float> query_points;
+    read_query_points(data, query_indices, query_points);
+    if (input_stamp(data.inputValue(aPoint).asFloat3(), data.inputValue(aVector).asFloat3(),
+        rays, query_points, _points_stamp) != baked_stamp) return false;
+
+    std::vector<std::pair<int, float>> weights(count);
+    for (int i = 0; i < count; ++i)
+    {
+        weights[i] = std::make_pair(entries[i].vertex, entries[i].weight);
+    }
+
+    const MStatus status = plug == aOutput ?
+        writeArrayOutput(data, _cache.numVertices(), weights) :
+        writeDenseOutput(data, _cache.numVertices(), weights);
+    return status == MS::kSuccess;
 }
 
+MStatus VertexNode::bakeKeys(MDGContext& context, unsigned long long& topology,
+    unsigned long long& settings, unsigned long long& stamp)
+{
+    // the inputs at that context, read in full, nothing of the last compute is reused
+    MDataBlock data = forceCache(context);
+    const MDataHandle& mesh_handle = data.inputValue(aInputMesh);
+    if (mesh_handle.type() != MFnData::kMesh) return MS::kInvalidParameter;
+
+    MStatus status;
+    MFnMesh fnMesh(mesh_handle.asMesh());
+    const unsigned int num_verts = fnMesh.numVertices();
+    MIntArray triangle_counts;
+    MIntArray triangle_vertices;
+    status = fnMesh.getTriangles(triangle_counts, triangle_vertices);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    const float* points = num_verts ? fnMesh.getRawPoints(&status) : nullptr;
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    std::vector<unsigned int> ray_indices;
+    std::vector<float> rays;
+    read_batch_rays(data, ray_indices, rays);
+    std::vector<unsigned int> query_indices;
+    std::vector<float> query_points;
+    read_query_points(data, query_indices, query_points);
+
+    topology = topology_hash(num_verts, triangle_vertices);
+    settings = settings_hash(data);
+    stamp = input_stamp(data.inputValue(aPoint).asFloat3(), data.inputValue(aVector).asFloat3(),
+        rays, query_points, points_stamp(points, num_verts));
+    return MS::kSuccess;
+}
 
-static float* cross_product(const float3 vector1, const float3 vector2)
+MStatus VertexNode::writeArrayOutput(MDataBlock& data, unsigned int num_verts,
+    const std::vector<std::pair<int, float>>& weights)
 {
-    static float3 cross;
-    for (unsigned int i = 0; i < 3; ++i)
+    MStatus status;
+
+    MArrayDataHandle output_array = data.outputArrayValue(aOutput);
+    MArrayDataBuilder output_builder = output_array.builder(&status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    const bool sparse_output = data.inputValue(aSparseOutput).asBool();
+
+    if (!sparse_output || num_verts != _output_size ||
+        output_builder.elementCount() != num_verts)
+    {
+        for (unsigned int i = 0; i < num_verts; ++i)
+        {
+            MDataHandle outHandle = output_builder.addElement(i);
+            outHandle.set(0.f);
+        }
+        _output_size = num_verts;
+    }
+    else
     {
-        cross[i] = vector1[(i + 1) % 3] * vector2[(i + 2) % 3] - vector1[(i + 2) % 3] * vector2[(i + 1) % 3];
+        // the builder keeps last evaluation elements, only the previous hits can be nonzero
+        for (size_t i = 0; i < _nonzero_vertices.size(); ++i)
+        {
+            MDataHandle outHandle = output_builder.addElement(_nonzero_vertices[i]);
+            outHandle.set(0.f);
+        }
     }
+    _nonzero_vertices.clear();
 
-    return cross;
-}
+    for (size_t i = 0; i < weights.size(); ++i)
+    {
+        MDataHandle data_handle = output_builder.addElement(weights[i].first);
+        data_handle.set(weights[i].second);
+        _nonzero_vertices.push_back(weights[i].first);
+    }
 
+    output_array.set(output_builder);
+    output_array.setAllClean();
+    return MS::kSuccess;
+}
 
-static float vector_magnitude(const float3 vector)
+MStatus VertexNode::writeDenseOutput(MDataBlock& data, unsigned int num_verts,
+    const std::vector<std::pair<int, float>>& weights)
 {
-    return sqrt(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
-}
\ No newline at end of file
+    MStatus status;
+
+    // one contiguous block, consumers read it straight from MFnFloatArrayData
+    MFloatArray dense_weights(num_verts, 0.f);
+    for (size_t i = 0; i < weights.size(); ++i)
+    {
+        dense_weights[weights[i].first] = weights[i].second;
+    }
+
+    MFnFloatArrayData weights_data;
+    MObject weights_object = weights_data.create(dense_weights, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MDataHandle weights_handle = data.outputValue(aOutputWeights);
+    weights_handle.set(weights_object);
+    weights_handle.setClean();
+    return MS::kSuccess;
+}
+
+MStatus VertexNode::writeQueryDistances(MDataBlock& data)
+{
+    MStatus status;
+
+    const int brick_size = data.inputValue(aSDFBrickSize).asInt();
+    const float budget = data.inputValue(aSDFMemoryBudget).asFloat();
+    updateSDF(brick_size, (size_t)(std::max(0.f, budget) * 1024.f * 1024.f));
+
+    std::vector<unsigned int> query_indices;
+    std::vector<float> query_points;
+    read_query_points(data, query_indices, query_points);
+    const float query_max_distance = data.inputValue(aQueryMaxDistance).asFloat();
+
+    auto query_start = std::chrono::high_resolution_clock::now();
+
+    // one trilinear lookup inside the band, an exact closest point search outside of it
+    const int num_queries = (int)query_indices.size();
+    std::vector<float> distances(num_queries, query_max_distance);
+    parallel_for(0, num_queries, QUERY_GRAIN_SIZE, [&](int begin, int end) {
+        for (int q = begin; q < end; ++q)
+        {
+            const float* point = &query_points[3 * q];
+            if (_sdf.distance(point, distances[q])) continue;
+
+            PointHit point_hit;
+            if (!_bvh.closestPoint(point, query_max_distance, point_hit))
+            {
+                distances[q] = query_max_distance;
+                continue;
+            }
+
+            // same sign convention as the field, the face normal of the closest triangle
+            const int* ids = _bvh.triangleVertices(point_hit.triangle);
+            const float* p0 = &_points[3 * ids[0]];
+            const float* p1 = &_points[3 * ids[1]];
+            const float* p2 = &_points[3 * ids[2]];
+            const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            const float normal[3] = {
+                e1[1] * e2[2] - e1[2] * e2[1],
+                e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0] };
+            float side = 0.f;
+            for (unsigned int k = 0; k < 3; ++k)
+            {
+                const float closest = p0[k] + point_hit.u * e1[k] + point_hit.v * e2[k];
+                side += (point[k] - closest) * normal[k];
+            }
+            distances[q] = side < 0.f ? -point_hit.distance : point_hit.distance;
+        }
+    });
+
+    _query_time = elapsed_ms(query_start);
+
+    MArrayDataBuilder distances_builder(&data, aQueryDistances, num_queries, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    for (int q = 0; q < num_queries; ++q)
+    {
+        distances_builder.addElement(query_indices[q]).set(distances[q]);
+    }
+
+    MArrayDataHandle distances_array = data.outputArrayValue(aQueryDistances);
+    distances_array.set(distances_builder);
+    distances_array.setAllClean();
+
+    if (data.inputValue(aProfile).asBool())
+    {
+        MString info("vertexNode distance field, build: ");
+        info += _build_time;
+        info += " ms, query: ";
+        info += _query_time;
+        info += " ms, voxel size: ";
+        info += _sdf.voxelSize();
+        info += ", bricks: ";
+        info += _sdf.numBricks();
+        info += ", memory: ";
+        info += (double)_sdf.memoryUsage() / (1024.0 * 1024.0);
+        info += " MB";
+        MGlobal::displayInfo(info);
+    }
+
+    return MS::kSuccess;
+}
+
+MStatus VertexNode::writeUVWeights(MDataBlock& data, const MFnMesh& fnMesh, unsigned int num_verts,
+    const std::vector<std::pair<int, float>>& weights)
+{
+    MStatus status;
+
+    // uv ids follow the bvh triangle table, triangles without uvs stay black
+    std::vector<int> triangle_uvs;
+    std::vector<float> uvs;
+    status = read_triangle_uvs(fnMesh, triangle_uvs, uvs);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    std::vector<float> vertex_weights(num_verts, 0.f);
+    for (size_t i = 0; i < weights.size(); ++i)
+    {
+        vertex_weights[weights[i].first] = weights[i].second;
+    }
+
+    const int resolution = data.inputValue(aUVResolution).asInt();
+    const int num_triangles = std::min(_bvh.numTriangles(), (int)triangle_uvs.size() / 3);
+    _uv_rasterizer.rasterize(uvs.data(), triangle_uvs.data(),
+        num_triangles ? _bvh.triangleVertices(0) : nullptr, num_triangles,
+        vertex_weights.data(), resolution, resolution, _uv_image);
+
+    const std::string path = data.inputValue(aUVFile).asString().asChar();
+    if (!path.empty() && !write_raw_image(path, _uv_image))
+    {
+        MGlobal::displayWarning(MString("vertexNode: cannot write uv weights ") + path.c_str());
+    }
+
+    MFnFloatArrayData uv_data;
+    MObject uv_object = uv_data.create(MFloatArray(_uv_image.data(), (unsigned int)_uv_image.size()), &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MDataHandle uv_handle = data.outputValue(aUVWeights);
+    uv_handle.set(uv_object);
+    uv_handle.setClean();
+    return MS::kSuccess;
+}
+
+MStatus VertexNode::writeVisibility(MDataBlock& data, const float3& position)
+{
+    MStatus status;
+
+    auto query_start = std::chrono::high_resolution_clock::now();
+
+    // any hit traversal stops at the first blocker, vertices are spread across threads
+    const int num_verts = (int)_points.size() / 3;
+    MFloatArray visibility(num_verts, 1.f);
+    parallel_for(0, num_verts, VISIBILITY_GRAIN_SIZE, [&](int begin, int end) {
+        for (int v = begin; v < end; ++v)
+        {
+            const float* vertex = &_points[3 * v];
+            const float direction[3] = {
+                position[0] - vertex[0],
+                position[1] - vertex[1],
+                position[2] - vertex[2] };
+            const float origin[3] = {
+                vertex[0] + VISIBILITY_EPSILON * direction[0],
+                vertex[1] + VISIBILITY_EPSILON * direction[1],
+                vertex[2] + VISIBILITY_EPSILON * direction[2] };
+
+            if (_bvh.occluded(origin, direction, 1.f - 2.f * VISIBILITY_EPSILON))
+            {
+                visibility[v] = 0.f;
+            }
+        }
+    });
+
+    _query_time = elapsed_ms(query_start);
+
+    MFnFloatArrayData visibility_data;
+    MObject visibility_object = visibility_data.create(visibility, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MDataHandle visibility_handle = data.outputValue(aVisibility);
+    visibility_handle.set(visibility_object);
+    visibility_handle.setClean();
+    return MS::kSuccess;
+}
+
+MStatus VertexNode::updateScene(MDataBlock& data)
+{
+    MStatus status;
+    _build_time = 0.0;
+    _refit_time = 0.0;
+
+    MArrayDataHandle mesh_array = data.inputArrayValue(aInputMeshes, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    // slots follow the physical order, a slot whose logical index moved is rebuilt
+    const unsigned int num_meshes = mesh_array.elementCount();
+    _scene_meshes.resize(num_meshes);
+    for (unsigned int i = 0; i < num_meshes; ++i)
+    {
+        mesh_array.jumpToArrayElement(i);
+        SceneMesh& slot = _scene_meshes[i];
+        const unsigned int index = mesh_array.elementIndex();
+        if (slot.index != index)
+        {
+            slot.index = index;
+            slot.topology_hash = 0;
+        }
+
+        const MDataHandle& mesh_handle = mesh_array.inputValue();
+        if (mesh_handle.type() != MFnData::kMesh)
+        {
+            slot.bvh.clear();
+            slot.points.clear();
+            slot.topology_hash = 0;
+            continue;
+        }
+
+        MFnMesh fnMesh(mesh_handle.asMesh());
+        MIntArray triangle_counts;
+        MIntArray triangle_vertices;
+        status = fnMesh.getTriangles(triangle_counts, triangle_vertices);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+
+        MFloatPointArray mesh_points;
+        status = fnMesh.getPoints(mesh_points, MSpace::kWorld);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+
+        const unsigned int num_verts = mesh_points.length();
+        std::vector<float> points(3 * num_verts);
+        for (unsigned int v = 0; v < num_verts; ++v)
+        {
+            points[3 * v] = mesh_points[v].x;
+            points[3 * v + 1] = mesh_points[v].y;
+            points[3 * v + 2] = mesh_points[v].z;
+        }
+
+        // bottom level trees are only rebuilt on a topology change, refit when deformed
+        const unsigned long long hash = topology_hash(num_verts, triangle_vertices);
+        const int num_triangles = (int)triangle_vertices.length() / 3;
+        if (hash != slot.topology_hash || slot.bvh.numTriangles() != num_triangles)
+        {
+            auto build_start = std::chrono::high_resolution_clock::now();
+            if (num_triangles)
+            {
+                slot.bvh.build(points.data(), &triangle_vertices[0], num_triangles);
+            }
+            else
+            {
+                slot.bvh.clear();
+            }
+            slot.topology_hash = hash;
+            _build_time += elapsed_ms(build_start);
+        }
+        else if (points != slot.points)
+        {
+            auto refit_start = std::chrono::high_resolution_clock::now();
+            slot.bvh.refit(points.data());
+            _refit_time += elapsed_ms(refit_start);
+        }
+        slot.points.swap(points);
+    }
+
+    // top level over the mesh roots, a few nodes per mesh so it is rebuilt every time
+    std::vector<const TriangleBVH*> meshes(num_meshes);
+    for (unsigned int i = 0; i < num_meshes; ++i)
+    {
+        meshes[i] = &_scene_meshes[i].bvh;
+    }
+    _scene.build(meshes);
+
+    return MS::kSuccess;
+}
+
+MStatus VertexNode::writeSceneHit(MDataBlock& data, const float3& position, const float3& vector)
+{
+    auto query_start = std::chrono::high_resolution_clock::now();
+
+    int mesh = -1;
+    RayHit hit;
+    const bool found = _scene.intersect(position, vector, MAX_RAY_PARAM, mesh, hit);
+
+    _query_time = elapsed_ms(query_start);
+
+    int vertex_id[3] = { -1, -1, -1 };
+    float weights[3] = { 0.f, 0.f, 0.f };
+    if (found)
+    {
+        const int* ids = _scene_meshes[mesh].bvh.triangleVertices(hit.triangle);
+        vertex_id[0] = ids[0];
+        vertex_id[1] = ids[1];
+        vertex_id[2] = ids[2];
+        weights[0] = 1.f - hit.u - hit.v;
+        weights[1] = hit.u;
+        weights[2] = hit.v;
+    }
+
+    MDataHandle mesh_handle = data.outputValue(aHitMesh);
+    mesh_handle.set(found ? (int)_scene_meshes[mesh].index : -1);
+    mesh_handle.setClean();
+
+    MDataHandle vertices_handle = data.outputValue(aHitMeshVertices);
+    vertices_handle.set3Int(vertex_id[0], vertex_id[1], vertex_id[2]);
+    vertices_handle.setClean();
+
+    MDataHandle weights_handle = data.outputValue(aHitMeshWeights);
+    weights_handle.set3Float(weights[0], weights[1], weights[2]);
+    weights_handle.setClean();
+
+    if (data.inputValue(aProfile).asBool())
+    {
+        MString info("vertexNode scene timings (ms), build: ");
+        info += _build_time;
+        info += ", refit: ";
+        info += _refit_time;
+        info += ", query: ";
+        info += _query_time;
+        info += ", meshes: ";
+        info += (unsigned int)_scene_meshes.size();
+        MGlobal::displayInfo(info);
+    }
+
+    return MS::kSuccess;
+}
+
+MStatus VertexNode::updateAdjacency(const MFnMesh& fnMesh)
+{
+    if (!_adjacency.empty() && _adjacency_hash == _topology_hash) return MS::kSuccess;
+
+    MStatus status;
+    MIntArray polygon_counts;
+    MIntArray polygon_vertices;
+    status = fnMesh.getVertices(polygon_counts, polygon_vertices);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    _adjacency.build(fnMesh.numVertices(),
+        polygon_counts.length() ? &polygon_counts[0] : nullptr, polygon_counts.length(),
+        polygon_vertices.length() ? &polygon_vertices[0] : nullptr);
+    _adjacency_hash = _topology_hash;
+
+    _ring_stamp.assign(_adjacency.numVertices(), 0);
+    _ring_generation = 0;
+    return MS::kSuccess;
+}
+
+void VertexNode::updateGeodesic(bool deform)
+{
+    bool factor = deform && _geodesic_version != _points_version;
+    if (_geodesic.empty() || _geodesic_hash != _topology_hash)
+    {
+        const int num_triangles = _bvh.numTriangles();
+        _geodesic.build((int)_points.size() / 3,
+            num_triangles ? _bvh.triangleVertices(0) : nullptr, num_triangles);
+        _geodesic_hash = _topology_hash;
+        factor = true;
+    }
+
+    // deformed points change the cotangent weights, the envelope stays. without deform
+    // the factorization of the first points is kept, a solve per compute is all it costs
+    if (factor)
+    {
+        _geodesic.factor(_points.data());
+        _geodesic_version = _points_version;
+    }
+}
+
+void VertexNode::updateSDF(int brick_size, size_t memory_budget)
+{
+    auto build_start = std::chrono::high_resolution_clock::now();
+    _build_time = 0.0;
+
+    if (_sdf_hash != _topology_hash || _sdf_brick_size != brick_size || _sdf_budget != memory_budget)
+    {
+        const int num_triangles = _bvh.numTriangles();
+        _sdf.build(_points.data(), (int)_points.size() / 3,
+            num_triangles ? _bvh.triangleVertices(0) : nullptr, num_triangles,
+            brick_size, memory_budget);
+        _sdf_hash = _topology_hash;
+        _sdf_brick_size = brick_size;
+        _sdf_budget = memory_budget;
+        _sdf_version = _points_version;
+        _build_time = elapsed_ms(build_start);
+    }
+    else if (_sdf_version != _points_version)
+    {
+        // deformed, same voxel size and the bricks are binned again
+        _sdf.update(_points.data(), (int)_points.size() / 3);
+        _sdf_version = _points_version;
+        _build_time = elapsed_ms(build_start);
+    }
+}
+
+void VertexNode::addRingWeights(const std::pair<int, float>* triangle, int rings,
+    std::vector<std::pair<int, float>>& contributions)
+{
+    // breadth first walk over the csr adjacency, stamps avoid clearing a visited array
+    if (++_ring_generation == 0)
+    {
+        std::fill(_ring_stamp.begin(), _ring_stamp.end(), 0);
+        _ring_generation = 1;
+    }
+
+    // heaviest seed first, so a vertex reached from two seeds keeps the larger weight
+    std::pair<int, float> seeds[3] = { triangle[0], triangle[1], triangle[2] };
+    std::sort(seeds, seeds + 3, [](const std::pair<int, float>& a, const std::pair<int, float>& b) {
+        return a.second > b.second;
+    });
+
+    std::vector<std::pair<int, float>> front;
+    std::vector<std::pair<int, float>> next;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        const int vertex = seeds[i].first;
+        if (vertex < 0 || vertex >= (int)_ring_stamp.size() || _ring_stamp[vertex] == _ring_generation) continue;
+        _ring_stamp[vertex] = _ring_generation;
+        front.push_back(seeds[i]);
+        contributions.push_back(seeds[i]);
+    }
+
+    for (int ring = 1; ring <= rings && !front.empty(); ++ring)
+    {
+        const float decay = falloff_weight((float)ring, (float)(rings + 1));
+        next.clear();
+        for (size_t i = 0; i < front.size(); ++i)
+        {
+            for (const int* n = _adjacency.begin(front[i].first); n != _adjacency.end(front[i].first); ++n)
+            {
+                if (_ring_stamp[*n] == _ring_generation) continue;
+                _ring_stamp[*n] = _ring_generation;
+                next.push_back(std::make_pair(*n, front[i].second));
+                contributions.push_back(std::make_pair(*n, front[i].second * decay));
+            }
+        }
+        front.swap(next);
+    }
+}
+
+void VertexNode::updateVertexTriangles()
+{
+    // counting sort of the bvh triangle table by vertex
+    const int num_verts = (int)_points.size() / 3;
+    const int num_triangles = _bvh.numTriangles();
+    _vertex_triangle_offsets.assign(num_verts + 1, 0);
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* ids = _bvh.triangleVertices(tri);
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            _vertex_triangle_offsets[ids[i] + 1]++;
+        }
+    }
+
+    for (int v = 0; v < num_verts; ++v)
+    {
+        _vertex_triangle_offsets[v + 1] += _vertex_triangle_offsets[v];
+    }
+
+    std::vector<int> fill(_vertex_triangle_offsets.begin(), _vertex_triangle_offsets.end() - 1);
+    _vertex_triangles.resize(_vertex_triangle_offsets[num_verts]);
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* ids = _bvh.triangleVertices(tri);
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            _vertex_triangles[fill[ids[i]]++] = tri;
+        }
+    }
+}
+
+bool VertexNode::intersectNearTriangle(int triangle, const float origin[3], const float direction[3],
+    RayHit& hit) const
+{
+    // one ring of triangles around the cached one, tested in packets by the same kernel as the bvh
+    int candidates[HIT_CACHE_MAX_TRIANGLES];
+    int num_candidates = 0;
+    const int* ids = _bvh.triangleVertices(triangle);
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        const int* first = _vertex_triangles.data() + _vertex_triangle_offsets[ids[i]];
+        const int* last = _vertex_triangles.data() + _vertex_triangle_offsets[ids[i] + 1];
+        for (const int* tri = first; tri != last && num_candidates < HIT_CACHE_MAX_TRIANGLES; ++tri)
+        {
+            if (std::find(candidates, candidates + num_candidates, *tri) == candidates + num_candidates)
+            {
+                candidates[num_candidates++] = *tri;
+            }
+        }
+    }
+
+    bool found = false;
+    hit.t = MAX_RAY_PARAM;
+    TrianglePacket packet;
+    for (int first = 0; first < num_candidates; first += RAY_PACKET_WIDTH)
+    {
+        const int count = std::min(RAY_PACKET_WIDTH, num_candidates - first);
+        fill_triangle_packet(packet, candidates + first, count, _bvh.triangleVertices(0), _points.data());
+
+        float t, u, v;
+        const int lane = intersect_packet(packet, origin, direction, hit.t, t, u, v);
+        if (lane < 0) continue;
+
+        hit.triangle = packet.triangle[lane];
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        found = true;
+    }
+
+    // closest of the ring is not the closest of the mesh when another surface moved in
+    // front of it. an any hit query stops at the first blocker and only walks the
+    // nodes before the hit, anything past the merge distance sends the ray to the bvh.
+    // the distance scales with t as in merge_coincident_hits, ring triangles sharing
+    // the hit edge must not block it
+    return found && !_bvh.occluded(origin, direction,
+        hit.t - HIT_MERGE_EPSILON * std::max(1.f, hit.t));
+}
+
+void VertexNode::updateGrid(float cell_size)
+{
+    // points moved or a new radius, the counting sort build is O(points)
+    if (_grid_version == _points_version && _grid.cellSize() == cell_size && !_grid.empty()) return;
+
+    _grid.build(_points.data(), (int)_points.size() / 3, cell_size);
+    _grid_version = _points_version;
+}
+
+MStatus VertexNode::updateAccelerator(MFnMesh& fnMesh)
+{
+    MStatus status;
+    _build_time = 0.0;
+    _refit_time = 0.0;
+
+    MIntArray triangle_counts;
+    MIntArray triangle_vertices;
+    status = fnMesh.getTriangles(triangle_counts, triangle_vertices);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    // the mesh data has no dag path, its object space points are the world space ones.
+    // read in place, copied only when they differ from the last compute
+    const unsigned int num_verts = fnMesh.numVertices();
+    const float* points = num_verts ? fnMesh.getRawPoints(&status) : nullptr;
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    const bool moved = _points.size() != 3 * (size_t)num_verts ||
+        (num_verts && memcmp(points, _points.data(), 3 * num_verts * sizeof(float)) != 0);
+
+    unsigned long long hash = topology_hash(num_verts, triangle_vertices);
+    int num_triangles = (int)triangle_vertices.length() / 3;
+    _topology_counts[0] = (int)num_verts;
+    _topology_counts[1] = fnMesh.numPolygons();
+    _topology_counts[2] = fnMesh.numFaceVertices();
+
+    if (hash != _topology_hash || _bvh.numTriangles() != num_triangles)
+    {
+        // new topology, full build, the bvh keeps the flat triangle table
+        auto build_start = std::chrono::high_resolution_clock::now();
+
+        if (num_triangles)
+        {
+            _bvh.build(points, &triangle_vertices[0], num_triangles);
+        }
+        else
+        {
+            _bvh.clear();
+        }
+        _topology_hash = hash;
+        _points_version++;
+
+        // cached triangle ids belong to the old table
+        _hit_cache.clear();
+        _vertex_triangle_offsets.clear();
+        _vertex_triangles.clear();
+        _cache_queries = 0;
+        _cache_hits = 0;
+
+        _build_time = elapsed_ms(build_start);
+    }
+    else if (moved)
+    {
+        // same topology, deformed points
+        auto refit_start = std::chrono::high_resolution_clock::now();
+        _bvh.refit(points);
+        _points_version++;
+        _refit_time = elapsed_ms(refit_start);
+    }
+
+    if (moved) _points.assign(points, points + 3 * num_verts);
+    return MS::kSuccess;
+}
+
+
+static inline float falloff_weight(float distance, float radius)
+{
+    // smooth (1 - x^2)^2 falloff, 1 at the hit and 0 with zero slope at the radius
+    const float x = distance / radius;
+    if (x >= 1.f) return 0.f;
+
+    const float s = 1.f - x * x;
+    return s * s;
+}
+
+
+static unsigned long long settings_hash(MDataBlock& data)
+{
+    // FNV-1a over every setting that changes the weights, animated inputs are left out
+    const float falloff_radius = data.inputValue(VertexNode::aFalloffRadius).asFloat();
+    const float cone_angle = data.inputValue(VertexNode::aConeAngle).asFloat();
+    const float query_max_distance = data.inputValue(VertexNode::aQueryMaxDistance).asFloat();
+    unsigned int values[9] = {
+        (unsigned int)data.inputValue(VertexNode::aFalloff).asShort(),
+        0u,
+        (unsigned int)data.inputValue(VertexNode::aFalloffRings).asInt(),
+        0u,
+        (unsigned int)data.inputValue(VertexNode::aConeSamples).asInt(),
+        (unsigned int)data.inputValue(VertexNode::aMultiHit).asBool(),
+        (unsigned int)data.inputValue(VertexNode::aHitCache).asBool(),
+        0u,
+        (unsigned int)data.inputValue(VertexNode::aGeodesicDeform).asBool() };
+    memcpy(&values[1], &falloff_radius, sizeof(float));
+    memcpy(&values[3], &cone_angle, sizeof(float));
+    memcpy(&values[7], &query_max_distance, sizeof(float));
+
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned int i = 0; i < 9; ++i)
+    {
+        hash = (hash ^ values[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+static unsigned long long points_stamp(const float* points, unsigned int num_points)
+{
+    // FNV-1a over the bits of the mesh points, the count first
+    unsigned long long hash = 14695981039346656037ULL;
+    hash = (hash ^ num_points) * 1099511628211ULL;
+    for (size_t i = 0; i < 3 * (size_t)num_points; ++i)
+    {
+        unsigned int bits;
+        memcpy(&bits, &points[i], sizeof(float));
+        hash = (hash ^ bits) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+static unsigned long long input_stamp(const float3& position, const float3& vector,
+    const std::vector<float>& rays, const std::vector<float>& query_points,
+    unsigned long long points_stamp)
+{
+    // FNV-1a over the bits of every other animated input the output weights read,
+    // the mesh points come in through their own stamp
+    unsigned long long hash = 14695981039346656037ULL;
+    auto add = [&hash](const float* values, size_t count) {
+        hash = (hash ^ (unsigned int)count) * 1099511628211ULL;
+        for (size_t i = 0; i < count; ++i)
+        {
+            unsigned int bits;
+            memcpy(&bits, &values[i], sizeof(float));
+            hash = (hash ^ bits) * 1099511628211ULL;
+        }
+    };
+
+    add(&position[0], 3);
+    add(&vector[0], 3);
+    add(rays.data(), rays.size());
+    add(query_points.data(), query_points.size());
+    hash = (hash ^ (unsigned int)points_stamp) * 1099511628211ULL;
+    hash = (hash ^ (unsigned int)(points_stamp >> 32)) * 1099511628211ULL;
+    return hash;
+}
+
+
+static double elapsed_ms(const std::chrono::high_resolution_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+}
+
+
+static void read_batch_rays(MDataBlock& data, std::vector<unsigned int>& ray_indices,
+    std::vector<float>& rays)
+{
+    // six floats per ray, origin and direction, rays without direction never hit
+    MStatus status;
+    MArrayDataHandle origin_array = data.inputArrayValue(VertexNode::aRayOrigin);
+    MArrayDataHandle direction_array = data.inputArrayValue(VertexNode::aRayDirection);
+
+    unsigned int num_rays = origin_array.elementCount();
+    ray_indices.reserve(num_rays);
+    rays.reserve(6 * num_rays);
+
+    for (unsigned int i = 0; i < num_rays; ++i)
+    {
+        origin_array.jumpToArrayElement(i);
+        const unsigned int index = origin_array.elementIndex();
+        const float3& origin = origin_array.inputValue().asFloat3();
+
+        float3 direction = { 0.f, 0.f, 0.f };
+        if (direction_array.jumpToElement(index))
+        {
+            const float3& value = direction_array.inputValue().asFloat3();
+            direction[0] = value[0];
+            direction[1] = value[1];
+            direction[2] = value[2];
+        }
+
+        ray_indices.push_back(index);
+        rays.insert(rays.end(), origin, origin + 3);
+        rays.insert(rays.end(), direction, direction + 3);
+    }
+}
+
+
+static void merge_coincident_hits(std::vector<RayHit>& hits)
+{
+    // a ray through a shared edge or vertex hits every adjacent triangle at the same t,
+    // hits are sorted so keeping the first of each run leaves one hit per crossing
+    size_t num_hits = 0;
+    for (size_t i = 0; i < hits.size(); ++i)
+    {
+        if (num_hits && hits[i].t - hits[num_hits - 1].t <=
+            HIT_MERGE_EPSILON * std::max(1.f, hits[i].t)) continue;
+        hits[num_hits++] = hits[i];
+    }
+    hits.resize(num_hits);
+}
+
+
+static void cone_direction(const float3& axis, float cone_angle, int sample, int num_samples,
+    float direction[3])
+{
+    // fibonacci spiral over the cap, one sample per equal area stratum of solid angle.
+    // deterministic so the same inputs always give the same weights
+    const float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    if (length == 0.f)
+    {
+        direction[0] = direction[1] = direction[2] = 0.f;
+        return;
+    }
+
+    const float n[3] = { axis[0] / length, axis[1] / length, axis[2] / length };
+
+    // any two unit vectors orthogonal to the axis
+    const float a[3] = { fabsf(n[0]) < 0.9f ? 1.f : 0.f, fabsf(n[0]) < 0.9f ? 0.f : 1.f, 0.f };
+    float b1[3] = {
+        n[1] * a[2] - n[2] * a[1],
+        n[2] * a[0] - n[0] * a[2],
+        n[0] * a[1] - n[1] * a[0] };
+    const float b1_length = sqrtf(b1[0] * b1[0] + b1[1] * b1[1] + b1[2] * b1[2]);
+    b1[0] /= b1_length;
+    b1[1] /= b1_length;
+    b1[2] /= b1_length;
+    const float b2[3] = {
+        n[1] * b1[2] - n[2] * b1[1],
+        n[2] * b1[0] - n[0] * b1[2],
+        n[0] * b1[1] - n[1] * b1[0] };
+
+    const float golden_angle = 2.39996323f;
+    const float cos_max = cosf(cone_angle * 3.14159265f / 180.f);
+    const float cos_theta = 1.f - (sample + 0.5f) / num_samples * (1.f - cos_max);
+    const float sin_theta = sqrtf(std::max(0.f, 1.f - cos_theta * cos_theta));
+    const float phi = golden_angle * sample;
+    const float x = sin_theta * cosf(phi);
+    const float y = sin_theta * sinf(phi);
+
+    // same length as vector, so ray parameters keep their meaning
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        direction[k] = length * (cos_theta * n[k] + x * b1[k] + y * b2[k]);
+    }
+}
+
+
+static void read_query_points(MDataBlock& data, std::vector<unsigned int>& query_indices,
+    std::vector<float>& query_points)
+{
+    MArrayDataHandle point_array = data.inputArrayValue(VertexNode::aQueryPoint);
+
+    unsigned int num_points = point_array.elementCount();
+    query_indices.reserve(num_points);
+    query_points.reserve(3 * num_points);
+
+    for (unsigned int i = 0; i < num_points; ++i)
+    {
+        point_array.jumpToArrayElement(i);
+        const float3& point = point_array.inputValue().asFloat3();
+
+        query_indices.push_back(point_array.elementIndex());
+        query_points.insert(query_points.end(), point, point + 3);
+    }
+}
+
+
+static MStatus read_triangle_uvs(const MFnMesh& fnMesh, std::vector<int>& triangle_uvs,
+    std::vector<float>& uvs)
+{
+    // same triangle order as getTriangles, each corner takes the uv of its face vertex
+    MStatus status;
+    MIntArray triangle_counts;
+    MIntArray triangle_vertices;
+    status = fnMesh.getTriangles(triangle_counts, triangle_vertices);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MIntArray polygon_counts;
+    MIntArray polygon_vertices;
+    status = fnMesh.getVertices(polygon_counts, polygon_vertices);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MIntArray uv_counts;
+    MIntArray uv_ids;
+    status = fnMesh.getAssignedUVs(uv_counts, uv_ids);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MFloatArray us;
+    MFloatArray vs;
+    status = fnMesh.getUVs(us, vs);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    uvs.resize(2 * us.length());
+    for (unsigned int i = 0; i < us.length(); ++i)
+    {
+        uvs[2 * i] = us[i];
+        uvs[2 * i + 1] = vs[i];
+    }
+
+    triangle_uvs.assign(triangle_vertices.length(), -1);
+    unsigned int tri_corner = 0;
+    unsigned int face_start = 0;
+    unsigned int uv_start = 0;
+    for (unsigned int face = 0; face < polygon_counts.length(); ++face)
+    {
+        // faces without uvs have no entries in uv_ids
+        const int face_size = polygon_counts[face];
+        const bool has_uvs = face < uv_counts.length() && uv_counts[face] == face_size;
+        for (int corner = 0; corner < 3 * triangle_counts[face]; ++corner, ++tri_corner)
+        {
+            if (!has_uvs) continue;
+            for (int k = 0; k < face_size; ++k)
+            {
+                if (polygon_vertices[face_start + k] != triangle_vertices[tri_corner]) continue;
+                triangle_uvs[tri_corner] = uv_ids[uv_start + k];
+                break;
+            }
+        }
+        face_start += face_size;
+        if (face < uv_counts.length()) uv_start += uv_counts[face];
+    }
+
+    return MS::kSuccess;
+}
@@ -2,6 +2,8 @@
 #define VERTEX_NODE_H
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <maya/MPxGeometryFilter.h>
 #include <maya/MItGeometry.h>
@@ -23,12 +25,30 @@
 
 #include <maya/MDataBlock.h>
 #include <maya/MDataHandle.h>
+#include <maya/MFnMesh.h>
 
+#include "triangleBVH.h"
+#include "sceneBVH.h"
+#include "spatialHashGrid.h"
+#include "meshAdjacency.h"
+#include "heatGeodesic.h"
+#include "weightCache.h"
+#include "uvRasterizer.h"
+#include "voxelSDF.h"
 
 
 class VertexNode : public MPxNode
 {
 public:
+    // falloff attribute values
+    enum FalloffMode
+    {
+        kFalloffNone = 0,    // barycentric weights of the hit triangle
+        kFalloffRadius = 1,  // euclidean distance to the hit point
+        kFalloffRing = 2,    // topological rings around the hit triangle
+        kFalloffGeodesic = 3,  // heat method distance over the surface to the hit
+    };
+
     VertexNode() {}
     virtual ~VertexNode() override {}
 
@@ -43,9 +63,145 @@ public:
 
     bool isPassiveOutput(const MPlug& plug) const;
 
+    // no shared state between instances, the evaluation manager may run them concurrently
+    SchedulingType schedulingType() const override { return kParallel; }
+
+    // keys a baked frame is stored with, hashed from the inputs at that context
+    MStatus bakeKeys(MDGContext& context, unsigned long long& topology,
+        unsigned long long& settings, unsigned long long& stamp);
+
+    // unmap the weight cache, while bypassed every compute is live. the mesh read while
+    // bypassed may be of other frames, it is stamped again on the next cached read
+    void closeCache() { _cache.close(); _cache_path.clear(); }
+    void setCacheBypass(bool bypass) { _cache_bypass = bypass; _mesh_dirty = true; }
+
 private:
+    // output weights from the baked cache, false when the live compute has to run: a
+    // subframe, another topology, other settings or inputs that moved since the bake
+    bool readCachedWeights(const MPlug& plug, MDataBlock& data);
+
+    // rebuild or refit the acceleration structure for the current mesh state
+    MStatus updateAccelerator(MFnMesh& fnMesh);
+
+    // triangles around each vertex, rebuilt with the bvh for the hit cache
+    void updateVertexTriangles();
+
+    // closest hit among the cached triangle and every triangle sharing one of its vertices,
+    // false as well when the bvh finds anything else in front of that hit
+    bool intersectNearTriangle(int triangle, const float origin[3], const float direction[3],
+        RayHit& hit) const;
+
+    // rebuild the point grid if the points moved since the last build
+    void updateGrid(float cell_size);
+
+    // csr adjacency, built once per topology on the first ring falloff
+    MStatus updateAdjacency(const MFnMesh& fnMesh);
+
+    // heat method operators, analyzed and factored per topology, refactored when points
+    // move only with deform on
+    void updateGeodesic(bool deform);
+
+    // sparse distance field, built per topology and brick settings, refilled when points move
+    void updateSDF(int brick_size, size_t memory_budget);
+
+    // spread the three (vertex, weight) pairs of a hit triangle over its k-ring
+    void addRingWeights(const std::pair<int, float>* triangle, int rings,
+        std::vector<std::pair<int, float>>& contributions);
+
+    // write the summed (vertex, weight) pairs of this compute
+    MStatus writeArrayOutput(MDataBlock& data, unsigned int num_verts,
+        const std::vector<std::pair<int, float>>& weights);
+    MStatus writeDenseOutput(MDataBlock& data, unsigned int num_verts,
+        const std::vector<std::pair<int, float>>& weights);
+
+    // one shadow ray per vertex towards the point input, 1 when nothing blocks it
+    MStatus writeVisibility(MDataBlock& data, const float3& position);
+
+    // signed distance of every query point, from the field or the bvh off its band
+    MStatus writeQueryDistances(MDataBlock& data);
+
+    // summed weights splatted into the uv square, optionally written to uvFile
+    MStatus writeUVWeights(MDataBlock& data, const MFnMesh& fnMesh, unsigned int num_verts,
+        const std::vector<std::pair<int, float>>& weights);
+
+    // per mesh trees of inputMeshes, then the top level tree over their bounds
+    MStatus updateScene(MDataBlock& data);
+
+    // closest hit of the point/vector ray over every mesh of inputMeshes
+    MStatus writeSceneHit(MDataBlock& data, const float3& position, const float3& vector);
+
     bool _dirty=false;
 
+    // triangle bvh, built once per topology and refit when points move
+    TriangleBVH _bvh;
+    unsigned long long _topology_hash=0;
+    int _topology_counts[3] = { -1, -1, -1 };  // vertices, polygons and face vertices it hashed
+    std::vector<float> _points;          // world space xyz, 3 floats per vertex
+    unsigned int _points_version=0;      // bumped every time _points changes
+
+    // last hit triangle per ray, slot 0 is the point/vector ray, -1 when it missed
+    std::vector<int> _hit_cache;
+    std::vector<int> _vertex_triangle_offsets;  // csr, num_verts + 1
+    std::vector<int> _vertex_triangles;
+    unsigned long long _cache_queries=0;  // rays that had a cached triangle
+    unsigned long long _cache_hits=0;     // of those, rays resolved without the bvh
+
+    // point grid for radius falloff, cell size follows the radius
+    SpatialHashGrid _grid;
+    SpatialHashGrid::QueryScratch _grid_scratch;
+    unsigned int _grid_version=0;
+
+    // vertex adjacency for ring falloff, keyed by the same topology hash
+    MeshAdjacency _adjacency;
+    unsigned long long _adjacency_hash=0;
+    std::vector<unsigned int> _ring_stamp;  // last walk that visited each vertex
+    unsigned int _ring_generation=0;
+
+    // geodesic falloff, keyed like the adjacency, refactored on a new points version with geodesicDeform
+    HeatGeodesic _geodesic;
+    unsigned long long _geodesic_hash=0;
+    unsigned int _geodesic_version=0;
+    std::vector<HeatGeodesic::Scratch> _geodesic_scratch;  // one per worker chunk of hit solves
+
+    // uv image of the weights, tile bins and pixels reused between computes
+    UVRasterizer _uv_rasterizer;
+    std::vector<float> _uv_image;
+
+    // one element of inputMeshes, its tree is kept while the topology stays the same
+    struct SceneMesh
+    {
+        unsigned int index=0;  // logical index in inputMeshes
+        unsigned long long topology_hash=0;
+        std::vector<float> points;  // world space xyz
+        TriangleBVH bvh;
+    };
+    std::vector<SceneMesh> _scene_meshes;
+    SceneBVH _scene;  // rebuilt every compute, only holds the mesh root bounds
+
+    // distance field for queryDistances, keyed like the geodesic operators
+    VoxelSDF _sdf;
+    unsigned long long _sdf_hash=0;
+    unsigned int _sdf_version=0;
+    int _sdf_brick_size=0;
+    size_t _sdf_budget=0;
+
+    // baked weights, mapped while the cacheFile path stays the same
+    WeightCache _cache;
+    std::string _cache_path;  // last path tried, a missing file is not retried every frame
+    bool _cache_bypass=false;
+    // stamp of the mesh points, taken again by a cached read after inputMesh was dirtied
+    unsigned long long _points_stamp=0;
+    bool _mesh_dirty=true;
+
+    // output elements written by the last compute, cleared first in sparse mode
+    std::vector<int> _nonzero_vertices;
+    unsigned int _output_size=0;
+
+    // last compute costs in milliseconds
+    double _build_time=0.0;
+    double _refit_time=0.0;
+    double _query_time=0.0;
+
 public:
     // attributes
     static MObject aInputMesh;
@@ -60,8 +216,61 @@ public:
     static MObject aVectorX;
     static MObject aVectorY;
     static MObject aVectorZ;
+
+    static MObject aProfile;  // print build, refit and query timings
+    static MObject aSparseOutput;  // only rewrite the output elements that changed
+    static MObject aHitCache;  // test around the last hit triangle before the bvh
+
+    static MObject aConeAngle;      // degrees, 0 keeps the single point/vector ray
+    static MObject aConeSamples;    // rays spread inside the cone
+
+    static MObject aFalloff;        // FalloffMode enum
+    static MObject aFalloffRadius;  // euclidean or geodesic
+    static MObject aFalloffRings;   // k for ring falloff
+    static MObject aGeodesicDeform; // refactor the geodesic operators when the points move
+
+    // batched rays, traced together in one compute
+    static MObject aRayOrigin;     // array of float3
+    static MObject aRayDirection;  // array of float3
+    static MObject aRayVertices;   // array, hit triangle vertex ids per ray
+    static MObject aRayWeights;    // array, hit triangle weights per ray
+
+    // batched closest point queries, no direction needed
+    static MObject aQueryPoint;        // array of float3
+    static MObject aQueryMaxDistance;  // points farther than this from the mesh get -1 ids
+    static MObject aQueryVertices;     // array, closest triangle vertex ids per query point
+    static MObject aQueryWeights;      // array, closest point weights per query point
+    static MObject aQueryDistances;    // array, signed distance per query point, positive outside
+
+    // sparse voxel distance field behind queryDistances
+    static MObject aSDFBrickSize;     // voxels per brick side
+    static MObject aSDFMemoryBudget;  // megabytes, the voxel size grows until the bricks fit
+
+    // point/vector ray against several meshes at once
+    static MObject aInputMeshes;      // array of meshes
+    static MObject aHitMesh;          // logical index of the hit mesh, -1 on a miss
+    static MObject aHitMeshVertices;  // hit triangle vertex ids in that mesh
+    static MObject aHitMeshWeights;   // hit triangle weights
+
+    // every intersection of the point/vector ray, sorted by distance
+    static MObject aMultiHit;
+    static MObject aHitDistances;  // float array data, one t per hit
+    static MObject aHitVertices;   // int array data, three vertex ids per hit
+    static MObject aHitWeights;    // float array data, three weights per hit
     
-    static MObject aOutput;  // array, one float per vertex
+    // baked weights, used instead of tracing when the cache matches the inputs
+    static MObject aTime;
+    static MObject aCacheFile;
+    static MObject aUseCache;
+
+    static MObject aOutput;  // array, one float per vertex, summed over all rays
+    static MObject aOutputWeights;  // float array data, same weights in one block
+    static MObject aVisibility;     // float array data, per vertex visibility of the point
+
+    // weights rasterized in uv space, current uv set
+    static MObject aUVResolution;  // pixels per side of the square image
+    static MObject aUVFile;        // raw float file written with each image, empty for none
+    static MObject aUVWeights;     // float array data, resolution^2 pixels, row 0 at v = 0
 
     // node data
     static MTypeId id;
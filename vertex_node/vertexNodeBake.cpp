@@ -0,0 +1,154 @@
+#include "vertexNodeBake.h"
+#include "vertexNode.h"
+#include "weightCache.h"
+
+#include <maya/MArgDatabase.h>
+#include <maya/MSelectionList.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MFnFloatArrayData.h>
+#include <maya/MFloatArray.h>
+#include <maya/MDGContext.h>
+#include <maya/MTime.h>
+#include <maya/MGlobal.h>
+
+#define START_FLAG "-sf"
+#define START_FLAG_LONG "-startFrame"
+#define END_FLAG "-ef"
+#define END_FLAG_LONG "-endFrame"
+#define FILE_FLAG "-f"
+#define FILE_FLAG_LONG "-file"
+
+MString VertexNodeBake::name("vertexNodeBake");
+
+void* VertexNodeBake::creator()
+{
+    return new VertexNodeBake;
+}
+
+MSyntax VertexNodeBake::newSyntax()
+{
+    MSyntax syntax;
+    syntax.addFlag(START_FLAG, START_FLAG_LONG, MSyntax::kLong);
+    syntax.addFlag(END_FLAG, END_FLAG_LONG, MSyntax::kLong);
+    syntax.addFlag(FILE_FLAG, FILE_FLAG_LONG, MSyntax::kString);
+    syntax.setObjectType(MSyntax::kSelectionList, 1, 1);
+    syntax.useSelectionAsDefault(true);
+    return syntax;
+}
+
+MStatus VertexNodeBake::doIt(const MArgList& arg_list)
+{
+    MStatus status;
+    MArgDatabase args(syntax(), arg_list, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    if (!args.isFlagSet(START_FLAG) || !args.isFlagSet(END_FLAG) || !args.isFlagSet(FILE_FLAG))
+    {
+        displayError("vertexNodeBake: -startFrame, -endFrame and -file are required");
+        return MS::kInvalidParameter;
+    }
+
+    int start_frame = 0;
+    int end_frame = 0;
+    MString path;
+    args.getFlagArgument(START_FLAG, 0, start_frame);
+    args.getFlagArgument(END_FLAG, 0, end_frame);
+    args.getFlagArgument(FILE_FLAG, 0, path);
+    if (end_frame < start_frame)
+    {
+        displayError("vertexNodeBake: -endFrame is before -startFrame");
+        return MS::kInvalidParameter;
+    }
+
+    MSelectionList selection;
+    args.getObjects(selection);
+    MObject node_object;
+    status = selection.getDependNode(0, node_object);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    MFnDependencyNode fn_node(node_object, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    if (fn_node.typeId() != VertexNode::id)
+    {
+        displayError("vertexNodeBake: " + fn_node.name() + " is not a vertexNode");
+        return MS::kInvalidParameter;
+    }
+
+    // the old file may be mapped by the node and must never feed its own bake
+    VertexNode* node = (VertexNode*)fn_node.userNode();
+    node->closeCache();
+    node->setCacheBypass(true);
+
+    MPlug weights_plug(node_object, VertexNode::aOutputWeights);
+    std::vector<std::vector<WeightCacheEntry>> frames(end_frame - start_frame + 1);
+    std::vector<unsigned long long> input_stamps(frames.size(), 0);
+    unsigned long long topology = 0;
+    unsigned long long settings = 0;
+    int num_vertices = -1;
+    for (int frame = start_frame; frame <= end_frame && status; ++frame)
+    {
+        MDGContext context(MTime((double)frame, MTime::uiUnit()));
+        MObject weights_object;
+        status = weights_plug.getValue(weights_object, context);
+        if (!status) break;
+
+        MFnFloatArrayData weights_data(weights_object, &status);
+        if (!status) break;
+
+        // the inputs this frame was computed from, the node refuses the frame once they move
+        unsigned long long frame_topology = 0;
+        unsigned long long frame_settings = 0;
+        status = node->bakeKeys(context, frame_topology, frame_settings, input_stamps[frame - start_frame]);
+        if (!status) break;
+
+        // the file keeps one settings and one topology key for the whole range
+        if (frame == start_frame)
+        {
+            topology = frame_topology;
+            settings = frame_settings;
+        }
+        if (frame_settings != settings)
+        {
+            displayError("vertexNodeBake: settings change inside the frame range");
+            status = MS::kFailure;
+            break;
+        }
+        if (frame_topology != topology)
+        {
+            displayError("vertexNodeBake: topology changes inside the frame range");
+            status = MS::kFailure;
+            break;
+        }
+
+        MFloatArray weights = weights_data.array();
+
+        // one vertex count for the whole range, a bake cannot follow topology changes
+        if (num_vertices < 0) num_vertices = (int)weights.length();
+        if ((int)weights.length() != num_vertices)
+        {
+            displayError("vertexNodeBake: vertex count changes inside the frame range");
+            status = MS::kFailure;
+            break;
+        }
+
+        std::vector<WeightCacheEntry>& entries = frames[frame - start_frame];
+        for (unsigned int v = 0; v < weights.length(); ++v)
+        {
+            if (weights[v] == 0.f) continue;
+            WeightCacheEntry entry = { (int)v, weights[v] };
+            entries.push_back(entry);
+        }
+    }
+    node->setCacheBypass(false);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    if (!write_weight_cache(path.asChar(), num_vertices, start_frame,
+        topology, settings, frames, input_stamps))
+    {
+        displayError("vertexNodeBake: cannot write " + path);
+        return MS::kFailure;
+    }
+
+    setResult((int)frames.size());
+    return MS::kSuccess;
+}
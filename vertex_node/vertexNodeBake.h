@@ -0,0 +1,30 @@
+#ifndef VERTEX_NODE_BAKE_H
+#define VERTEX_NODE_BAKE_H
+
+#include <maya/MPxCommand.h>
+#include <maya/MArgList.h>
+#include <maya/MSyntax.h>
+#include <maya/MString.h>
+
+/*
+vertexNodeBake -startFrame 1 -endFrame 100 -file "weights.vnwc" vertexNode1;
+Evaluates outputWeights of a vertexNode at every frame of the range through
+a DG context, without moving the timeline, and writes the nonzero weights
+to a weight cache file the node can map back with useCache and cacheFile.
+*/
+class VertexNodeBake : public MPxCommand
+{
+public:
+    VertexNodeBake() {}
+    virtual ~VertexNodeBake() override {}
+
+    static void* creator();
+    static MSyntax newSyntax();
+
+    MStatus doIt(const MArgList& args) override;
+    bool isUndoable() const override { return false; }
+
+    static MString name;
+};
+
+#endif // !VERTEX_NODE_BAKE_H
@@ -0,0 +1,46 @@
+#ifndef VERTEX_WEIGHTS_H
+#define VERTEX_WEIGHTS_H
+
+/*
+Barycentric weights of a point against the three vertices of a triangle.
+Independent from the Maya API and without shared state, so any thread can
+call it and it can be checked outside of the node.
+*/
+
+// barycentric weights of the three triangle vertices, returned by value
+struct VertexWeights
+{
+    float w[3];
+};
+
+inline VertexWeights get_vertex_weight(
+    const float* vertex1, const float* vertex2, const float* vertex3, const float* point)
+{
+    // closed form barycentric coordinates, no shared state so any thread can call it
+    const float v0[3] = { vertex2[0] - vertex1[0], vertex2[1] - vertex1[1], vertex2[2] - vertex1[2] };
+    const float v1[3] = { vertex3[0] - vertex1[0], vertex3[1] - vertex1[1], vertex3[2] - vertex1[2] };
+    const float v2[3] = { point[0] - vertex1[0], point[1] - vertex1[1], point[2] - vertex1[2] };
+
+    const float dot00 = v0[0] * v0[0] + v0[1] * v0[1] + v0[2] * v0[2];
+    const float dot01 = v0[0] * v1[0] + v0[1] * v1[1] + v0[2] * v1[2];
+    const float dot11 = v1[0] * v1[0] + v1[1] * v1[1] + v1[2] * v1[2];
+    const float dot20 = v2[0] * v0[0] + v2[1] * v0[1] + v2[2] * v0[2];
+    const float dot21 = v2[0] * v1[0] + v2[1] * v1[1] + v2[2] * v1[2];
+
+    VertexWeights weights;
+    const float denom = dot00 * dot11 - dot01 * dot01;
+    if (denom == 0.f)
+    {
+        // degenerate triangle, split evenly
+        weights.w[0] = weights.w[1] = weights.w[2] = 1.f / 3.f;
+        return weights;
+    }
+
+    const float inv_denom = 1.f / denom;
+    weights.w[1] = (dot11 * dot20 - dot01 * dot21) * inv_denom;
+    weights.w[2] = (dot00 * dot21 - dot01 * dot20) * inv_denom;
+    weights.w[0] = 1.f - weights.w[1] - weights.w[2];
+    return weights;
+}
+
+#endif // !VERTEX_WEIGHTS_H
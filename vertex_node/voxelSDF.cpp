@@ -0,0 +1,442 @@
+#include "voxelSDF.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "../common/parallelFor.h"
+#include "triangleBVH.h"
+
+// samples this many voxels away from the surface are exact, lookups stay a voxel inside
+#define SDF_BAND_VOXELS 3
+// coordinate bits per axis in a packed brick key
+#define SDF_KEY_BITS 21
+#define SDF_EMPTY_KEY 0xFFFFFFFFFFFFFFFFULL
+// bricks filled per worker chunk
+#define SDF_BRICK_GRAIN 4
+// triangles binned per worker chunk
+#define SDF_TRIANGLE_GRAIN 4096
+// the voxel size grows by this factor while the bricks do not fit the budget
+#define SDF_COARSEN_FACTOR 1.5f
+#define SDF_MAX_SEARCH_STEPS 24
+// squared distances this close are a tie, broken by the better aligned face normal
+#define SDF_TIE_EPSILON 1e-4f
+
+static inline unsigned long long brick_key(int x, int y, int z);
+static inline unsigned long long hash_key(unsigned long long key);
+
+void VoxelSDF::clear()
+{
+    _triangles.clear();
+    _num_points = 0;
+    _voxel_size = 0.f;
+    _inv_voxel_size = 0.f;
+    _band = 0.f;
+    _table_keys.clear();
+    _table_bricks.clear();
+    _table_mask = 0;
+    _brick_keys.clear();
+    _brick_offsets.clear();
+    _brick_triangles.clear();
+    _samples.clear();
+}
+
+void VoxelSDF::build(const float* points, int num_points, const int* triangle_vertices, int num_triangles,
+    int brick_size, size_t memory_budget)
+{
+    clear();
+    if (num_points <= 0 || num_triangles <= 0) return;
+
+    _triangles.assign(triangle_vertices, triangle_vertices + 3 * num_triangles);
+    _num_points = num_points;
+    _brick_size = std::max(2, brick_size);
+    _memory_budget = memory_budget;
+
+    // voxels finer than the edges add memory without detail, start at the mean edge length
+    double edge_length = 0.0;
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* ids = &_triangles[3 * tri];
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            const float* p = points + 3 * ids[i];
+            const float* q = points + 3 * ids[(i + 1) % 3];
+            edge_length += sqrt((q[0] - p[0]) * (q[0] - p[0]) +
+                (q[1] - p[1]) * (q[1] - p[1]) + (q[2] - p[2]) * (q[2] - p[2]));
+        }
+    }
+    edge_length /= 3.0 * num_triangles;
+
+    search(points, edge_length > 0.0 ? (float)edge_length : 1.f);
+}
+
+void VoxelSDF::update(const float* points, int num_points)
+{
+    if (_triangles.empty() || num_points != _num_points) return;
+
+    const int samples = (_brick_size + 1) * (_brick_size + 1) * (_brick_size + 1);
+    const size_t max_bricks = _memory_budget / (samples * sizeof(float));
+    if (_voxel_size > 0.f && bin(points, _voxel_size, max_bricks))
+    {
+        fill(points);
+        return;
+    }
+
+    search(points, _voxel_size > 0.f ? _voxel_size * SDF_COARSEN_FACTOR : 1.f);
+}
+
+void VoxelSDF::search(const float* points, float voxel_size)
+{
+    const int samples = (_brick_size + 1) * (_brick_size + 1) * (_brick_size + 1);
+    const size_t max_bricks = _memory_budget / (samples * sizeof(float));
+
+    for (int step = 0; step < SDF_MAX_SEARCH_STEPS && max_bricks; ++step)
+    {
+        if (bin(points, voxel_size, max_bricks))
+        {
+            fill(points);
+            return;
+        }
+        voxel_size *= SDF_COARSEN_FACTOR;
+    }
+
+    // not even one brick fits, every lookup falls back to the surface search
+    _brick_keys.clear();
+    _samples.clear();
+    _voxel_size = 0.f;
+}
+
+bool VoxelSDF::bin(const float* points, float voxel_size, size_t max_bricks)
+{
+    const int num_triangles = (int)_triangles.size() / 3;
+    _voxel_size = voxel_size;
+    _inv_voxel_size = 1.f / voxel_size;
+    _band = SDF_BAND_VOXELS * voxel_size;
+
+    // a voxel of padding keeps every sample index positive
+    float bmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float bmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int i = 0; i < _num_points; ++i)
+    {
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+            bmin[k] = std::min(bmin[k], points[3 * i + k]);
+            bmax[k] = std::max(bmax[k], points[3 * i + k]);
+        }
+    }
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        _origin[k] = bmin[k] - _band - voxel_size;
+        if ((bmax[k] + _band - _origin[k]) * _inv_voxel_size / _brick_size + 2.f >= (float)(1 << SDF_KEY_BITS))
+        {
+            return false;
+        }
+    }
+
+    // 1. brick range of every triangle grown by the band, in parallel
+    std::vector<int> ranges(6 * num_triangles);
+    parallel_for(0, num_triangles, SDF_TRIANGLE_GRAIN, [&](int begin, int end) {
+        for (int tri = begin; tri < end; ++tri)
+        {
+            const int* ids = &_triangles[3 * tri];
+            int* range = &ranges[6 * tri];
+            for (unsigned int k = 0; k < 3; ++k)
+            {
+                const float lo = std::min(points[3 * ids[0] + k], std::min(points[3 * ids[1] + k], points[3 * ids[2] + k]));
+                const float hi = std::max(points[3 * ids[0] + k], std::max(points[3 * ids[1] + k], points[3 * ids[2] + k]));
+
+                // samples of brick b are b * brick_size .. (b + 1) * brick_size, shared on the faces
+                const int first = (int)std::ceil((lo - _band - _origin[k]) * _inv_voxel_size);
+                const int last = (int)std::floor((hi + _band - _origin[k]) * _inv_voxel_size);
+                range[k] = (std::max(first, 1) - 1) / _brick_size;
+                range[3 + k] = last / _brick_size;
+            }
+        }
+    });
+
+    // 2. unique bricks through the hash table, in triangle order so the layout is stable
+    _brick_keys.clear();
+    _table_keys.assign(1024, SDF_EMPTY_KEY);
+    _table_bricks.assign(1024, -1);
+    _table_mask = 1023;
+    for (int tri = 0; tri < num_triangles; ++tri)
+    {
+        const int* range = &ranges[6 * tri];
+        for (int z = range[2]; z <= range[5]; ++z)
+        {
+            for (int y = range[1]; y <= range[4]; ++y)
+            {
+                for (int x = range[0]; x <= range[3]; ++x)
+                {
+                    insert(brick_key(x, y, z));
+                }
+            }
+        }
+        if (_brick_keys.size() > max_bricks) return false;
+    }
+
+    // 3. csr triangle lists per brick
+    const int num_bricks = (int)_brick_keys.size();
+    _brick_offsets.assign(num_bricks + 1, 0);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        std::vector<int> cursor(_brick_offsets.begin(), _brick_offsets.end() - 1);
+        if (pass == 1) _brick_triangles.resize(_brick_offsets[num_bricks]);
+        for (int tri = 0; tri < num_triangles; ++tri)
+        {
+            const int* range = &ranges[6 * tri];
+            for (int z = range[2]; z <= range[5]; ++z)
+            {
+                for (int y = range[1]; y <= range[4]; ++y)
+                {
+                    for (int x = range[0]; x <= range[3]; ++x)
+                    {
+                        const int brick = find(brick_key(x, y, z));
+                        if (pass == 0) _brick_offsets[brick + 1]++;
+                        else _brick_triangles[cursor[brick]++] = tri;
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (int b = 0; b < num_bricks; ++b)
+            {
+                _brick_offsets[b + 1] += _brick_offsets[b];
+            }
+        }
+    }
+
+    return true;
+}
+
+void VoxelSDF::fill(const float* points)
+{
+    const int num_triangles = (int)_triangles.size() / 3;
+    const int num_bricks = (int)_brick_keys.size();
+    const int side = _brick_size + 1;
+    const int samples = side * side * side;
+
+    // v0, e1, e2 and the unit normal of every triangle
+    std::vector<float> frames(12 * num_triangles);
+    parallel_for(0, num_triangles, SDF_TRIANGLE_GRAIN, [&](int begin, int end) {
+        for (int tri = begin; tri < end; ++tri)
+        {
+            const int* ids = &_triangles[3 * tri];
+            float* frame = &frames[12 * tri];
+            for (unsigned int k = 0; k < 3; ++k)
+            {
+                frame[k] = points[3 * ids[0] + k];
+                frame[3 + k] = points[3 * ids[1] + k] - frame[k];
+                frame[6 + k] = points[3 * ids[2] + k] - frame[k];
+            }
+            const float* e1 = frame + 3;
+            const float* e2 = frame + 6;
+            float* normal = frame + 9;
+            normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            const float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            const float inv_length = length > 0.f ? 1.f / length : 0.f;
+            normal[0] *= inv_length;
+            normal[1] *= inv_length;
+            normal[2] *= inv_length;
+        }
+    });
+
+    // every brick only against its own triangles, each task owns its samples
+    _samples.assign((size_t)num_bricks * samples, FLT_MAX);
+    const float band2 = _band * _band;
+    parallel_for(0, num_bricks, SDF_BRICK_GRAIN, [&](int begin, int end) {
+        std::vector<float> best2(samples);
+        std::vector<float> best_alignment(samples);
+        for (int brick = begin; brick < end; ++brick)
+        {
+            std::fill(best2.begin(), best2.end(), FLT_MAX);
+            std::fill(best_alignment.begin(), best_alignment.end(), 0.f);
+
+            const unsigned long long key = _brick_keys[brick];
+            const unsigned long long key_mask = (1ULL << SDF_KEY_BITS) - 1;
+            const int base[3] = {
+                (int)(key & key_mask) * _brick_size,
+                (int)((key >> SDF_KEY_BITS) & key_mask) * _brick_size,
+                (int)((key >> (2 * SDF_KEY_BITS)) & key_mask) * _brick_size };
+
+            for (int k = _brick_offsets[brick]; k < _brick_offsets[brick + 1]; ++k)
+            {
+                const float* frame = &frames[12 * _brick_triangles[k]];
+                const float* v0 = frame;
+                const float* e1 = frame + 3;
+                const float* e2 = frame + 6;
+                const float* normal = frame + 9;
+
+                // samples inside the triangle bounds grown by the band
+                int first[3], last[3];
+                for (unsigned int a = 0; a < 3; ++a)
+                {
+                    const float lo = std::min(v0[a], std::min(v0[a] + e1[a], v0[a] + e2[a]));
+                    const float hi = std::max(v0[a], std::max(v0[a] + e1[a], v0[a] + e2[a]));
+                    first[a] = std::max(0, (int)std::ceil((lo - _band - _origin[a]) * _inv_voxel_size) - base[a]);
+                    last[a] = std::min(_brick_size, (int)std::floor((hi + _band - _origin[a]) * _inv_voxel_size) - base[a]);
+                }
+
+                for (int z = first[2]; z <= last[2]; ++z)
+                {
+                    for (int y = first[1]; y <= last[1]; ++y)
+                    {
+                        for (int x = first[0]; x <= last[0]; ++x)
+                        {
+                            const float point[3] = {
+                                _origin[0] + (base[0] + x) * _voxel_size,
+                                _origin[1] + (base[1] + y) * _voxel_size,
+                                _origin[2] + (base[2] + z) * _voxel_size };
+
+                            // the plane distance is a lower bound, most samples already have a closer triangle
+                            const int sample = (z * side + y) * side + x;
+                            const float limit2 = std::min(band2, best2[sample] * (1.f + SDF_TIE_EPSILON));
+                            const float plane = (point[0] - v0[0]) * normal[0] + (point[1] - v0[1]) * normal[1] +
+                                (point[2] - v0[2]) * normal[2];
+                            if (plane * plane > limit2) continue;
+
+                            float u, v;
+                            const float distance2 = closest_point_on_triangle(v0, e1, e2, point, u, v);
+                            if (distance2 > limit2) continue;
+
+                            // cosine between the normal and the offset to the closest point, picks the sign
+                            float alignment = 0.f;
+                            if (distance2 > 0.f)
+                            {
+                                const float offset[3] = {
+                                    point[0] - v0[0] - u * e1[0] - v * e2[0],
+                                    point[1] - v0[1] - u * e1[1] - v * e2[1],
+                                    point[2] - v0[2] - u * e1[2] - v * e2[2] };
+                                alignment = (offset[0] * normal[0] + offset[1] * normal[1] + offset[2] * normal[2]) /
+                                    sqrtf(distance2);
+                            }
+
+                            // a closest point on a shared edge or vertex ties, the face facing the sample wins
+                            if (distance2 >= best2[sample] * (1.f - SDF_TIE_EPSILON) &&
+                                fabsf(alignment) <= fabsf(best_alignment[sample])) continue;
+
+                            best2[sample] = std::min(best2[sample], distance2);
+                            best_alignment[sample] = alignment;
+                        }
+                    }
+                }
+            }
+
+            float* brick_samples = &_samples[(size_t)brick * samples];
+            for (int sample = 0; sample < samples; ++sample)
+            {
+                if (best2[sample] == FLT_MAX) continue;
+                const float distance = sqrtf(best2[sample]);
+                brick_samples[sample] = best_alignment[sample] < 0.f ? -distance : distance;
+            }
+        }
+    });
+
+    // the triangle lists are rebuilt with the next bin
+    _brick_offsets.clear();
+    _brick_triangles.clear();
+}
+
+bool VoxelSDF::distance(const float point[3], float& distance) const
+{
+    if (_brick_keys.empty()) return false;
+
+    int cell[3];
+    int brick[3];
+    float f[3];
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        const float g = (point[k] - _origin[k]) * _inv_voxel_size;
+        if (!(g >= 0.f) || g >= (float)(1 << SDF_KEY_BITS) * _brick_size) return false;
+
+        const int i = (int)g;
+        brick[k] = i / _brick_size;
+        cell[k] = i - brick[k] * _brick_size;
+        f[k] = g - i;
+    }
+
+    const int index = find(brick_key(brick[0], brick[1], brick[2]));
+    if (index < 0) return false;
+
+    const int side = _brick_size + 1;
+    const float* s = &_samples[(size_t)index * side * side * side + (cell[2] * side + cell[1]) * side + cell[0]];
+    const float c[8] = {
+        s[0], s[1], s[side], s[side + 1],
+        s[side * side], s[side * side + 1], s[side * side + side], s[side * side + side + 1] };
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+        if (c[i] == FLT_MAX) return false;
+    }
+
+    const float x0 = c[0] + f[0] * (c[1] - c[0]);
+    const float x1 = c[2] + f[0] * (c[3] - c[2]);
+    const float x2 = c[4] + f[0] * (c[5] - c[4]);
+    const float x3 = c[6] + f[0] * (c[7] - c[6]);
+    const float y0 = x0 + f[1] * (x1 - x0);
+    const float y1 = x2 + f[1] * (x3 - x2);
+    distance = y0 + f[2] * (y1 - y0);
+    return true;
+}
+
+int VoxelSDF::find(unsigned long long key) const
+{
+    if (_table_keys.empty()) return -1;
+
+    for (unsigned long long slot = hash_key(key) & _table_mask;; slot = (slot + 1) & _table_mask)
+    {
+        if (_table_keys[slot] == key) return _table_bricks[slot];
+        if (_table_keys[slot] == SDF_EMPTY_KEY) return -1;
+    }
+}
+
+int VoxelSDF::insert(unsigned long long key)
+{
+    // keep the load under one half, rehash from the brick list
+    if (2 * (_brick_keys.size() + 1) > _table_keys.size())
+    {
+        const size_t size = 2 * _table_keys.size();
+        _table_keys.assign(size, SDF_EMPTY_KEY);
+        _table_bricks.assign(size, -1);
+        _table_mask = size - 1;
+        for (size_t b = 0; b < _brick_keys.size(); ++b)
+        {
+            unsigned long long slot = hash_key(_brick_keys[b]) & _table_mask;
+            while (_table_keys[slot] != SDF_EMPTY_KEY) slot = (slot + 1) & _table_mask;
+            _table_keys[slot] = _brick_keys[b];
+            _table_bricks[slot] = (int)b;
+        }
+    }
+
+    unsigned long long slot = hash_key(key) & _table_mask;
+    for (; _table_keys[slot] != SDF_EMPTY_KEY; slot = (slot + 1) & _table_mask)
+    {
+        if (_table_keys[slot] == key) return _table_bricks[slot];
+    }
+
+    _table_keys[slot] = key;
+    _table_bricks[slot] = (int)_brick_keys.size();
+    _brick_keys.push_back(key);
+    return _table_bricks[slot];
+}
+
+
+static inline unsigned long long brick_key(int x, int y, int z)
+{
+    return (unsigned long long)x | ((unsigned long long)y << SDF_KEY_BITS) |
+        ((unsigned long long)z << (2 * SDF_KEY_BITS));
+}
+
+
+static inline unsigned long long hash_key(unsigned long long key)
+{
+    // splitmix64 finalizer, neighbouring bricks land far apart
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
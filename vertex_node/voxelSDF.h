@@ -0,0 +1,78 @@
+#ifndef VOXEL_SDF_H
+#define VOXEL_SDF_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+Sparse narrow band signed distance field of a triangle mesh.
+Space is cut in bricks of brick_size^3 voxels, only the bricks within the
+band of some triangle are allocated. Each brick stores its own
+(brick_size + 1)^3 corner samples, so a lookup is one hash probe and one
+trilinear blend inside a single brick. Bricks are filled in parallel, each
+one only against the triangles binned to it.
+The sign comes from the face normal of the closest triangle, it is only
+meaningful for consistently wound meshes. Samples with no triangle within
+the band are left unknown and a lookup touching one of them fails, the
+caller falls back to an exact surface search there.
+*/
+
+class VoxelSDF
+{
+public:
+    VoxelSDF() {}
+
+    // finest voxel size whose bricks fit memory_budget bytes, then every brick is filled.
+    // copies the triangle table, the points are only read here and by update()
+    void build(const float* points, int num_points, const int* triangle_vertices, int num_triangles,
+        int brick_size, size_t memory_budget);
+
+    // same topology and voxel size, bricks are rebinned and refilled for the new points.
+    // the voxel size is searched again if the bricks outgrow the budget
+    void update(const float* points, int num_points);
+
+    void clear();
+
+    bool empty() const { return _brick_keys.empty(); }
+    float voxelSize() const { return _voxel_size; }
+    float bandWidth() const { return _band; }
+    int brickSize() const { return _brick_size; }
+    int numBricks() const { return (int)_brick_keys.size(); }
+    size_t memoryUsage() const { return _samples.size() * sizeof(float); }
+
+    // trilinear signed distance, false when point is off the band
+    bool distance(const float point[3], float& distance) const;
+
+private:
+    // coarsen from voxel_size until the bricks fit the budget, then fill them
+    void search(const float* points, float voxel_size);
+
+    // bricks and their triangle lists at voxel_size, false past max_bricks or the key range
+    bool bin(const float* points, float voxel_size, size_t max_bricks);
+    void fill(const float* points);
+
+    int find(unsigned long long key) const;
+    int insert(unsigned long long key);
+
+    std::vector<int> _triangles;  // three vertex ids per triangle
+    int _num_points=0;
+    int _brick_size=8;
+    size_t _memory_budget=0;
+
+    float _voxel_size=0.f;
+    float _inv_voxel_size=0.f;
+    float _band=0.f;
+    float _origin[3]={0.f, 0.f, 0.f};
+
+    // open addressing table from packed brick coordinates to brick index
+    std::vector<unsigned long long> _table_keys;
+    std::vector<int> _table_bricks;
+    unsigned long long _table_mask=0;
+
+    std::vector<unsigned long long> _brick_keys;
+    std::vector<int> _brick_offsets;    // csr triangles per brick, only used while filling
+    std::vector<int> _brick_triangles;
+    std::vector<float> _samples;        // (brick_size + 1)^3 per brick, x fastest
+};
+
+#endif // !VOXEL_SDF_H
@@ -0,0 +1,203 @@
+#include "weightCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define WEIGHT_CACHE_MAGIC "VNWC"
+#define WEIGHT_CACHE_VERSION 2
+
+bool write_weight_cache(const std::string& path, int num_vertices, int first_frame,
+    unsigned long long topology_hash, unsigned long long settings_hash,
+    const std::vector<std::vector<WeightCacheEntry>>& frames,
+    const std::vector<unsigned long long>& input_stamps)
+{
+    if (input_stamps.size() != frames.size()) return false;
+
+    WeightCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WEIGHT_CACHE_MAGIC, 4);
+    header.version = WEIGHT_CACHE_VERSION;
+    header.num_vertices = num_vertices;
+    header.first_frame = first_frame;
+    header.num_frames = (int)frames.size();
+    header.topology_hash = topology_hash;
+    header.settings_hash = settings_hash;
+
+    std::vector<unsigned long long> offsets(frames.size() + 1, 0);
+    for (size_t f = 0; f < frames.size(); ++f)
+    {
+        offsets[f + 1] = offsets[f] + frames[f].size();
+    }
+
+    // a reader may still map the old file, it is only replaced once the new one is whole
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)offsets.data(), offsets.size() * sizeof(unsigned long long));
+        if (!input_stamps.empty())
+        {
+            file.write((const char*)input_stamps.data(), input_stamps.size() * sizeof(unsigned long long));
+        }
+        for (size_t f = 0; f < frames.size(); ++f)
+        {
+            if (frames[f].empty()) continue;
+            file.write((const char*)frames[f].data(), frames[f].size() * sizeof(WeightCacheEntry));
+        }
+        if (!file) return false;
+    }
+
+    std::remove(path.c_str());
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool WeightCache::open(const std::string& path)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG)sizeof(WeightCacheHeader))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data)
+    {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    _file = file;
+    _mapping = mapping;
+    _size = (size_t)size.QuadPart;
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size < (off_t)sizeof(WeightCacheHeader))
+    {
+        ::close(file);
+        return false;
+    }
+
+    // the mapping keeps its own reference, the descriptor is not needed afterwards
+    void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+    ::close(file);
+    if (data == MAP_FAILED) return false;
+
+    _size = (size_t)info.st_size;
+#endif
+
+    _data = data;
+    _path = path;
+
+    // header, then the offset and stamp tables must fit
+    const WeightCacheHeader* header = (const WeightCacheHeader*)_data;
+    const size_t table_size = header->num_frames >= 0 ?
+        (2 * (size_t)header->num_frames + 1) * sizeof(unsigned long long) : 0;
+    if (memcmp(header->magic, WEIGHT_CACHE_MAGIC, 4) != 0 || header->version != WEIGHT_CACHE_VERSION ||
+        header->num_frames < 0 || header->num_vertices < 0 ||
+        sizeof(WeightCacheHeader) + table_size > _size)
+    {
+        close();
+        return false;
+    }
+
+    // the entry block must be whole, the size is compared in entries so a huge last
+    // offset cannot wrap around
+    const unsigned long long* offsets =
+        (const unsigned long long*)((const char*)_data + sizeof(WeightCacheHeader));
+    const size_t entries_start = sizeof(WeightCacheHeader) + table_size;
+    const size_t entries_size = _size - entries_start;
+    const unsigned long long num_entries = offsets[header->num_frames];
+    if (entries_size % sizeof(WeightCacheEntry) != 0 || num_entries != entries_size / sizeof(WeightCacheEntry))
+    {
+        close();
+        return false;
+    }
+
+    // every frame slice inside the block, and every entry on a vertex of the bake,
+    // a truncated or corrupt file is refused here rather than read past later
+    const WeightCacheEntry* entries = (const WeightCacheEntry*)((const char*)_data + entries_start);
+    bool valid = offsets[0] == 0;
+    for (int f = 0; valid && f < header->num_frames; ++f)
+    {
+        valid = offsets[f] <= offsets[f + 1];
+    }
+    for (unsigned long long i = 0; valid && i < num_entries; ++i)
+    {
+        valid = entries[i].vertex >= 0 && entries[i].vertex < header->num_vertices;
+    }
+    if (!valid)
+    {
+        close();
+        return false;
+    }
+
+    _header = header;
+    _offsets = offsets;
+    _stamps = offsets + header->num_frames + 1;
+    _entries = entries;
+    return true;
+}
+
+void WeightCache::close()
+{
+    if (_data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+        CloseHandle((HANDLE)_mapping);
+        CloseHandle((HANDLE)_file);
+#else
+        munmap(_data, _size);
+#endif
+    }
+
+    _path.clear();
+    _header = nullptr;
+    _offsets = nullptr;
+    _stamps = nullptr;
+    _entries = nullptr;
+    _data = nullptr;
+    _size = 0;
+    _file = nullptr;
+    _mapping = nullptr;
+}
+
+bool WeightCache::frame(int frame, const WeightCacheEntry*& entries, int& count,
+    unsigned long long& input_stamp) const
+{
+    if (!_header) return false;
+
+    const int index = frame - _header->first_frame;
+    if (index < 0 || index >= _header->num_frames) return false;
+
+    entries = _entries + _offsets[index];
+    count = (int)(_offsets[index + 1] - _offsets[index]);
+    input_stamp = _stamps[index];
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef WEIGHT_CACHE_H
+#define WEIGHT_CACHE_H
+
+#include <string>
+#include <vector>
+
+/*
+Baked per frame vertex weights in one binary file, read through a memory map.
+Layout: a fixed header, num_frames + 1 offsets (in entries) into the entry
+block, num_frames input stamps, then the sparse (vertex, weight) entries of
+every frame back to back, so a frame slice is two offset reads and a pointer
+into the mapping.
+The topology and settings hashes let the reader refuse a stale bake, the
+stamp of a frame hashes the animated inputs it was baked from so a frame
+whose inputs changed since is refused on its own.
+*/
+
+struct WeightCacheEntry
+{
+    int vertex;
+    float weight;
+};
+
+struct WeightCacheHeader
+{
+    char magic[4];  // "VNWC"
+    unsigned int version;
+    int num_vertices;
+    int first_frame;
+    int num_frames;
+    unsigned int reserved;
+    unsigned long long topology_hash;
+    unsigned long long settings_hash;
+};
+
+// write frames first_frame .. first_frame + frames.size() - 1 and their input stamps,
+// replaces path only once complete
+bool write_weight_cache(const std::string& path, int num_vertices, int first_frame,
+    unsigned long long topology_hash, unsigned long long settings_hash,
+    const std::vector<std::vector<WeightCacheEntry>>& frames,
+    const std::vector<unsigned long long>& input_stamps);
+
+class WeightCache
+{
+public:
+    WeightCache() {}
+    ~WeightCache() { close(); }
+
+    // maps the file read only, false if it is missing or not a valid cache
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return _header != nullptr; }
+    const std::string& path() const { return _path; }
+
+    int numVertices() const { return _header ? _header->num_vertices : 0; }
+    int firstFrame() const { return _header ? _header->first_frame : 0; }
+    int numFrames() const { return _header ? _header->num_frames : 0; }
+    unsigned long long topologyHash() const { return _header ? _header->topology_hash : 0; }
+    unsigned long long settingsHash() const { return _header ? _header->settings_hash : 0; }
+
+    // entries of one frame straight from the mapping and the stamp of the inputs it
+    // was baked from, false outside the baked range
+    bool frame(int frame, const WeightCacheEntry*& entries, int& count,
+        unsigned long long& input_stamp) const;
+
+private:
+    WeightCache(const WeightCache&);
+    WeightCache& operator=(const WeightCache&);
+
+    std::string _path;
+    const WeightCacheHeader* _header=nullptr;
+    const unsigned long long* _offsets=nullptr;
+    const unsigned long long* _stamps=nullptr;
+    const WeightCacheEntry* _entries=nullptr;
+
+    // mapping handles, the file and mapping objects only exist on windows
+    void* _data=nullptr;
+    size_t _size=0;
+    void* _file=nullptr;
+    void* _mapping=nullptr;
+};
+
+#endif // !WEIGHT_CACHE_H